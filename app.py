@@ -49,6 +49,29 @@ def api_get(path):
     except Exception as e:
         return {"status": "error", "detail": str(e)}
 
+# last (ETag, body) per path; survives reruns so revalidation can send If-None-Match
+@st.cache_resource
+def _etag_store():
+    return {}
+
+def api_get_conditional(path):
+    store = _etag_store()
+    cached = store.get(path)
+    headers = {"If-None-Match": cached[0]} if cached else {}
+    try:
+        r = requests.get(f"{BASE_URL}{path}", headers=headers, timeout=REQUEST_TIMEOUT)
+        if r.status_code == 304 and cached:
+            return cached[1]
+        try:
+            body = r.json()
+        except:
+            return {"status": "error", "detail": r.text[:400]}
+        if r.headers.get("ETag"):
+            store[path] = (r.headers["ETag"], body)
+        return body
+    except Exception as e:
+        return {"status": "error", "detail": str(e)}
+
 def api_post(path, payload):
     try:
         r = requests.post(f"{BASE_URL}{path}", json=payload, timeout=REQUEST_TIMEOUT)
@@ -64,7 +87,7 @@ def api_post(path, payload):
 def fetch_accounts_cached(user_id):
     if not user_id:
         return []
-    res = api_get(f"/accounts/{user_id}")
+    res = api_get_conditional(f"/accounts/{user_id}")
     if isinstance(res, list):
         return res
     return []
@@ -73,7 +96,7 @@ def fetch_accounts_cached(user_id):
 def fetch_transactions_cached(account_number):
     if not account_number:
         return []
-    res = api_get(f"/transactions/{account_number}")
+    res = api_get_conditional(f"/transactions/{account_number}")
     if isinstance(res, list):
         return res
     return []
@@ -0,0 +1,428 @@
+// bench.cpp - microbenchmarks for the server's hot helpers
+// Build: g++ bench.cpp -O2 -std=c++17 -lsqlite3 -lz -pthread -o bench
+//
+// Covers sha256, random_hex, now_iso, to_str, request parsing and response
+// serialisation for each endpoint's payload shape, the transactions listing
+// in JSON, MessagePack and CBOR, its gzip/deflate compression with a reused
+// compressor against a fresh one, and prepared statement reuse against a
+// fresh prepare per call. For every benchmark it reports
+// ns/op (median of --reps runs), C++ heap allocations/op (operator new;
+// SQLite's own allocator is not counted) and, where the kernel allows
+// perf_event_open, user-space instructions/op. Results go to stdout as JSON;
+// a table goes to stderr.
+//
+//   ./bench > before.json
+//   ./bench --baseline before.json --threshold 10   # exit 1 on >10% ns/op regressions
+//   ./bench --filter json.                          # substring match on names
+
+#include "minibank.h"
+
+#include <cstdio>
+#include <fstream>
+#include <new>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// --- allocation counting: every operator new in the process goes through here
+static std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(std::size_t n)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new(std::size_t n, std::align_val_t a)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    // aligned_alloc wants a size that is a non-zero multiple of the alignment
+    size_t align = (size_t)a, bytes = std::max(align, (n + align - 1) / align * align);
+    if (void *p = std::aligned_alloc(align, bytes))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) { return operator new(n); }
+void *operator new[](std::size_t n, std::align_val_t a) { return operator new(n, a); }
+
+// every delete frees through here: inlined into callers, a free() of what
+// the replaced operator new returned trips -Wmismatched-new-delete
+[[gnu::noinline]] static void release(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, std::size_t) noexcept { release(p); }
+void operator delete[](void *p, std::size_t) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { release(p); }
+
+namespace
+{
+
+template <class T>
+inline void keep(T const &v)
+{
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+// user-space retired instructions of this thread; -1 if perf is unavailable
+class InstructionCounter
+{
+public:
+    InstructionCounter()
+    {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~InstructionCounter()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+    bool available() const { return fd_ >= 0; }
+    void start()
+    {
+        if (fd_ < 0)
+            return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    long long stop()
+    {
+        if (fd_ < 0)
+            return -1;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        long long v = 0;
+        return read(fd_, &v, sizeof(v)) == (ssize_t)sizeof(v) ? v : -1;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+struct Options
+{
+    std::string filter;
+    std::string baseline;
+    std::string schema = "setup.sql";
+    double threshold = 10; // percent
+    double min_time = 0.1; // seconds per rep
+    int reps = 5;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t iters;
+    double ns_per_op;
+    double allocs_per_op;
+    double instructions_per_op; // < 0 when not measured
+};
+
+class Runner
+{
+public:
+    explicit Runner(const Options &o) : o_(o) {}
+
+    void run(const std::string &name, const std::function<void(uint64_t)> &body)
+    {
+        if (!o_.filter.empty() && name.find(o_.filter) == std::string::npos)
+            return;
+        // grow the batch until one rep takes at least min_time
+        uint64_t n = 1;
+        for (;;)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            body(n);
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            if (s >= o_.min_time || n >= (1ULL << 32))
+                break;
+            n = s <= 0 ? n * 10 : std::max(n + 1, (uint64_t)(n * std::min(10.0, 1.2 * o_.min_time / s)));
+        }
+        std::vector<double> ns;
+        uint64_t allocs = 0;
+        long long instr = -1;
+        for (int r = 0; r < o_.reps; ++r)
+        {
+            uint64_t a0 = g_allocs.load(std::memory_order_relaxed);
+            counter_.start();
+            auto t0 = std::chrono::steady_clock::now();
+            body(n);
+            auto t1 = std::chrono::steady_clock::now();
+            long long in = counter_.stop();
+            uint64_t a = g_allocs.load(std::memory_order_relaxed) - a0;
+            ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / (double)n);
+            if (r == 0 || a < allocs)
+                allocs = a;
+            if (in >= 0 && (instr < 0 || in < instr))
+                instr = in;
+        }
+        std::sort(ns.begin(), ns.end());
+        Result res{name, n, ns[ns.size() / 2], (double)allocs / (double)n, instr < 0 ? -1.0 : (double)instr / (double)n};
+        std::fprintf(stderr, "%-36s %12.1f ns/op %8.2f allocs/op", name.c_str(), res.ns_per_op, res.allocs_per_op);
+        if (res.instructions_per_op >= 0)
+            std::fprintf(stderr, " %10.0f instr/op", res.instructions_per_op);
+        std::fprintf(stderr, "\n");
+        results_.push_back(res);
+    }
+
+    json to_json() const
+    {
+        json out;
+        out["instructions_counted"] = counter_.available();
+        out["benchmarks"] = json::array();
+        for (const Result &r : results_)
+        {
+            json b = {{"name", r.name}, {"iterations", r.iters}, {"ns_per_op", r.ns_per_op}, {"allocs_per_op", r.allocs_per_op}};
+            b["instructions_per_op"] = r.instructions_per_op < 0 ? json(nullptr) : json(r.instructions_per_op);
+            out["benchmarks"].push_back(b);
+        }
+        return out;
+    }
+
+    // prints each benchmark that got slower than threshold percent; returns
+    // how many did
+    int compare(const json &base) const
+    {
+        std::map<std::string, double> old;
+        for (const auto &b : base.value("benchmarks", json::array()))
+            old[b.value("name", "")] = b.value("ns_per_op", 0.0);
+        int regressions = 0;
+        for (const Result &r : results_)
+        {
+            auto it = old.find(r.name);
+            if (it == old.end() || it->second <= 0)
+                continue;
+            double pct = (r.ns_per_op / it->second - 1.0) * 100.0;
+            if (pct > o_.threshold)
+            {
+                std::fprintf(stderr, "REGRESSION %-36s %10.1f -> %10.1f ns/op (%+.1f%%)\n", r.name.c_str(), it->second, r.ns_per_op, pct);
+                ++regressions;
+            }
+        }
+        return regressions;
+    }
+
+private:
+    const Options &o_;
+    InstructionCounter counter_;
+    std::vector<Result> results_;
+};
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--filter")
+            o.filter = next();
+        else if (a == "--baseline")
+            o.baseline = next();
+        else if (a == "--threshold")
+            o.threshold = std::stod(next());
+        else if (a == "--min-time")
+            o.min_time = std::stod(next());
+        else if (a == "--reps")
+            o.reps = std::max(1, std::stoi(next()));
+        else if (a == "--schema")
+            o.schema = next();
+        else
+        {
+            std::cerr << "usage: bench [--filter SUBSTR] [--baseline FILE.json] [--threshold PCT]\n"
+                         "             [--min-time SECONDS] [--reps N] [--schema setup.sql]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// request bodies as the frontend sends them
+const std::pair<const char *, const char *> kRequests[] = {
+    {"signup", R"({"email":"alice@example.com","password":"correct horse battery"})"},
+    {"login", R"({"email":"alice@example.com","password":"correct horse battery"})"},
+    {"create_account", R"({"user_id":42,"type":"Checking"})"},
+    {"deposit", R"({"account_number":"ACC1234567","amount":250.75})"},
+    {"transfer", R"({"from":"ACC1234567","to":"ACC7654321","amount":19.99})"},
+    {"profile_update", R"({"user_id":42,"name":"Alice Example","phone":"+1 555 0100","address":"1 Infinite Loop, Cupertino"})"},
+};
+
+// response bodies, built the way the handlers build them
+json response_shape(const std::string &name)
+{
+    if (name == "login")
+        return {{"status", "ok"}, {"user_id", 42}, {"email", "alice@example.com"}};
+    if (name == "transfer")
+        return {{"status", "ok"}, {"tx_uuid", "0123456789abcdef"}};
+    if (name == "accounts")
+    {
+        json arr = json::array();
+        for (int i = 0; i < 4; ++i)
+            arr.push_back({{"account_number", "ACC" + std::to_string(1000000 + i)}, {"account_type", "Savings"}, {"balance", 1234.56 * (i + 1)}});
+        return arr;
+    }
+    // /transactions/{acc}: a page of 100 ledger rows
+    json arr = json::array();
+    for (int i = 0; i < 100; ++i)
+        arr.push_back({{"amount", 10.0 + i * 0.25}, {"from", i % 3 ? "ACC1234567" : ""}, {"to", i % 3 == 1 ? "" : "ACC7654321"}, {"time", "2026-10-18 12:34:56"}});
+    return arr;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, o))
+        return 2;
+    Runner bench(o);
+
+    // --- helpers
+    bench.run("sha256.salted_password", [](uint64_t n)
+              { std::string in = random_hex(24) + "correct horse battery";
+                for (uint64_t i = 0; i < n; ++i) keep(sha256(in)); });
+    bench.run("random_hex.16", [](uint64_t n)
+              { for (uint64_t i = 0; i < n; ++i) keep(random_hex(16)); });
+    bench.run("random_hex.24", [](uint64_t n)
+              { for (uint64_t i = 0; i < n; ++i) keep(random_hex(24)); });
+    bench.run("now_iso", [](uint64_t n)
+              { for (uint64_t i = 0; i < n; ++i) keep(now_iso()); });
+    bench.run("to_str.account_number", [](uint64_t n)
+              { const unsigned char *s = reinterpret_cast<const unsigned char *>("ACC1234567");
+                for (uint64_t i = 0; i < n; ++i) keep(to_str(s)); });
+    bench.run("to_str.null", [](uint64_t n)
+              { for (uint64_t i = 0; i < n; ++i) keep(to_str(nullptr)); });
+
+    // --- request parsing and response serialisation, through the handlers' own helpers
+    for (const auto &rq : kRequests)
+    {
+        httplib::Request req;
+        req.body = rq.second;
+        bench.run(std::string("json.parse.") + rq.first, [&](uint64_t n)
+                  { for (uint64_t i = 0; i < n; ++i) keep(parse_body(req)); });
+    }
+    for (const char *shape : {"login", "transfer", "accounts", "transactions"})
+    {
+        json j = response_shape(shape);
+        bench.run(std::string("json.dump.") + shape, [&](uint64_t n)
+                  { for (uint64_t i = 0; i < n; ++i) { httplib::Response res; send_json(res, j); keep(res.body); } });
+        bench.run(std::string("json.build_dump.") + shape, [&](uint64_t n)
+                  { for (uint64_t i = 0; i < n; ++i) { httplib::Response res; send_json(res, response_shape(shape)); keep(res.body); } });
+    }
+
+    // --- the transactions listing in each wire encoding: server-side encode,
+    // client-side decode, and its size (stderr)
+    {
+        json j = response_shape("transactions");
+        for (Wire w : {Wire::Json, Wire::MsgPack, Wire::Cbor})
+        {
+            std::string tag = w == Wire::Json ? "json" : w == Wire::MsgPack ? "msgpack" : "cbor";
+            std::string body = encode(j, w);
+            std::cerr << "wire." << tag << ".transactions: " << body.size() << " bytes\n";
+            bench.run("wire.encode." + tag + ".transactions", [&](uint64_t n)
+                      { t_wire = w;
+                        for (uint64_t i = 0; i < n; ++i) { httplib::Response res; send_json(res, j); keep(res.body); }
+                        t_wire = Wire::Json; });
+            bench.run("wire.decode." + tag + ".transactions", [&](uint64_t n)
+                      { httplib::Request req;
+                        req.body = body;
+                        req.set_header("Content-Type", wire_type(w));
+                        for (uint64_t i = 0; i < n; ++i) keep(parse_body(req)); });
+        }
+    }
+
+    // --- response compression of the JSON listing: a thread's reused
+    // compressor against a fresh one per response, and the size (stderr)
+    {
+        std::string body = encode(response_shape("transactions"), Wire::Json);
+        for (Coding c : Compressor::kCodings)
+        {
+            std::string tag = coding_name(c);
+            {
+                Compressor z(c, Compressor::kDefaultLevel);
+                std::string out;
+                z.compress(body.data(), body.size(), true, out);
+                std::cerr << "compress." << tag << ".transactions: " << body.size() << " -> " << out.size() << " bytes\n";
+            }
+            bench.run("compress." + tag + ".transactions", [&](uint64_t n)
+                      { Compressor z(c, Compressor::kDefaultLevel);
+                        for (uint64_t i = 0; i < n; ++i) { std::string out; z.reset(); z.compress(body.data(), body.size(), true, out); keep(out); } });
+            bench.run("compress." + tag + ".transactions.fresh", [&](uint64_t n)
+                      { for (uint64_t i = 0; i < n; ++i) { Compressor z(c, Compressor::kDefaultLevel); std::string out; z.compress(body.data(), body.size(), true, out); keep(out); } });
+        }
+    }
+
+    // --- statements: what every handler does (prepare, step, finalize) vs a cached statement
+    std::ifstream schema_in(o.schema);
+    if (schema_in)
+    {
+        std::stringstream schema;
+        schema << schema_in.rdbuf();
+        sqlite3 *db = nullptr;
+        sqlite3_open(":memory:", &db);
+        exec_sql(db, schema.str().c_str());
+        exec_sql(db, "PRAGMA foreign_keys=OFF; BEGIN;");
+        for (int i = 0; i < 10000; ++i)
+            exec_sql(db, ("INSERT INTO accounts (user_id, account_number, account_type, balance, created_at) VALUES (" + std::to_string(i % 5000 + 1) + ", 'ACC" + std::to_string(1000000 + i) + "', 'Savings', 100, '2026-01-01 00:00:00');").c_str());
+        exec_sql(db, "COMMIT;");
+        const char *sel = "SELECT balance FROM accounts WHERE account_number = ?";
+        const char *upd = "UPDATE accounts SET balance = balance + ? WHERE account_number = ? RETURNING balance";
+        const char *acc = "ACC1004242";
+        for (const char *sql : {sel, upd})
+        {
+            std::string tag = sql == sel ? "select_balance" : "update_balance";
+            bench.run("sql.prepare_each." + tag, [&](uint64_t n)
+                      { for (uint64_t i = 0; i < n; ++i) {
+                            sqlite3_stmt *stmt = nullptr;
+                            sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+                            if (sql == upd) sqlite3_bind_double(stmt, 1, 0.0);
+                            sqlite3_bind_text(stmt, sql == upd ? 2 : 1, acc, -1, SQLITE_TRANSIENT);
+                            keep(sqlite3_step(stmt));
+                            sqlite3_finalize(stmt); } });
+            sqlite3_stmt *cached = nullptr;
+            sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &cached, nullptr);
+            bench.run("sql.reuse." + tag, [&](uint64_t n)
+                      { for (uint64_t i = 0; i < n; ++i) {
+                            if (sql == upd) sqlite3_bind_double(cached, 1, 0.0);
+                            sqlite3_bind_text(cached, sql == upd ? 2 : 1, acc, -1, SQLITE_STATIC);
+                            keep(sqlite3_step(cached));
+                            sqlite3_reset(cached); } });
+            sqlite3_finalize(cached);
+        }
+        sqlite3_close(db);
+    }
+    else
+        std::cerr << "skipping sql.* benchmarks: cannot read " << o.schema << "\n";
+
+    json out = bench.to_json();
+    std::cout << out.dump(2) << "\n";
+
+    if (!o.baseline.empty())
+    {
+        std::ifstream in(o.baseline);
+        json base;
+        try
+        {
+            in >> base;
+        }
+        catch (...)
+        {
+            std::cerr << "cannot parse baseline " << o.baseline << "\n";
+            return 2;
+        }
+        if (bench.compare(base) > 0)
+            return 1;
+    }
+    return 0;
+}
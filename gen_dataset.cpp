@@ -0,0 +1,493 @@
+// gen_dataset.cpp - synthetic MiniBank database for scale testing
+// Build: g++ gen_dataset.cpp -O2 -std=c++17 -lsqlite3 -lz -pthread -o gen_dataset
+//
+// Creates a fresh database from setup.sql and fills it with customers,
+// their accounts, a set of merchant accounts, and --years of ledger history
+// in time order. Each row carries its running balances, so the server starts
+// on it without a backfill.
+//
+// Traffic model, per customer account and month (--tx-per-month on average):
+//   salary      8%  deposit, per-account income ~ lognormal (median ~2700)
+//   cash in     4%  small deposit
+//   atm        10%  withdrawal in multiples of 20
+//   merchant   58%  payment ~ lognormal (median ~25) to a Zipf-ranked merchant
+//   p2p        20%  transfer ~ lognormal (median ~55), a third of them
+//                   between the same customer's accounts
+// A debit the account cannot cover is replaced by a salary deposit, so
+// balances never go negative. Every generated user can log in with
+// --password.
+//
+//   ./gen_dataset --out big.db --users 200000 --accounts 2 --years 3 --tx-per-month 8
+
+#include "minibank.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace
+{
+
+struct Options
+{
+    std::string out = "bank_gen.db";
+    std::string schema = "setup.sql";
+    long users = 10000;
+    double accounts = 2;       // mean accounts per customer (at least 1)
+    double years = 2;
+    double tx_per_month = 20;  // per customer account
+    long merchants = 500;
+    double merchant_zipf = 1.1;
+    std::string password = "password";
+    unsigned long long seed = 42;
+    bool force = false;
+};
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--out")
+            o.out = next();
+        else if (a == "--schema")
+            o.schema = next();
+        else if (a == "--users")
+            o.users = std::stol(next());
+        else if (a == "--accounts")
+            o.accounts = std::stod(next());
+        else if (a == "--years")
+            o.years = std::stod(next());
+        else if (a == "--tx-per-month")
+            o.tx_per_month = std::stod(next());
+        else if (a == "--merchants")
+            o.merchants = std::stol(next());
+        else if (a == "--merchant-zipf")
+            o.merchant_zipf = std::stod(next());
+        else if (a == "--password")
+            o.password = next();
+        else if (a == "--seed")
+            o.seed = std::stoull(next());
+        else if (a == "--force")
+            o.force = true;
+        else
+        {
+            std::cerr << "usage: gen_dataset [--out FILE] [--schema setup.sql] [--users N] [--accounts MEAN]\n"
+                         "                   [--years Y] [--tx-per-month N] [--merchants N] [--merchant-zipf S]\n"
+                         "                   [--password P] [--seed N] [--force]\n";
+            return false;
+        }
+    }
+    return o.users > 0 && o.accounts >= 1 && o.years > 0 && o.tx_per_month > 0 && o.merchants > 0;
+}
+
+// splitmix64 finaliser: a bijection, so hashing a counter gives unique ids
+inline uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline void hex16(uint64_t v, char *out)
+{
+    static const char *hex = "0123456789abcdef";
+    for (int i = 15; i >= 0; --i, v >>= 4)
+        out[i] = hex[v & 0xF];
+    out[16] = 0;
+}
+
+// local "YYYY-MM-DD HH:MM:SS" like now_iso(); asks localtime_r for the UTC
+// offset once per hour (zone changes happen on quarter hours at worst, so
+// that is exact) and does the calendar arithmetic itself
+class TimeFormatter
+{
+public:
+    const char *operator()(std::time_t t)
+    {
+        std::time_t hour = t - t % 3600;
+        if (hour != hour_)
+        {
+            std::tm tm{};
+            localtime_r(&hour, &tm);
+            offset_ = tm.tm_gmtoff;
+            hour_ = hour;
+        }
+        long long local = (long long)t + offset_;
+        long long days = local / 86400, secs = local % 86400;
+        if (secs < 0)
+            secs += 86400, --days;
+        // civil_from_days (H. Hinnant)
+        long long z = days + 719468;
+        long long era = (z >= 0 ? z : z - 146096) / 146097;
+        unsigned doe = (unsigned)(z - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        unsigned d = doy - (153 * mp + 2) / 5 + 1;
+        unsigned m = mp < 10 ? mp + 3 : mp - 9;
+        long long y = (long long)yoe + era * 400 + (m <= 2);
+        std::snprintf(buf_, sizeof(buf_), "%04lld-%02u-%02u %02d:%02d:%02d", y, m, d,
+                      (int)(secs / 3600), (int)(secs / 60 % 60), (int)(secs % 60));
+        return buf_;
+    }
+
+private:
+    std::time_t hour_ = -1;
+    long offset_ = 0;
+    char buf_[48]; // wide enough for any long long year, not just four digits
+};
+
+// Zipf(s) over ranks 0..n-1 by inverse CDF; rank 0 is the hottest
+class Zipf
+{
+public:
+    Zipf(size_t n, double s)
+    {
+        cdf_.resize(n);
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            cdf_[i] = (sum += 1.0 / std::pow((double)(i + 1), s));
+        for (double &c : cdf_)
+            c /= sum;
+    }
+    template <class Rng>
+    size_t operator()(Rng &rng) const
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::min(cdf_.size() - 1, (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin()));
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+struct Account
+{
+    std::string number;
+    long user;
+    double balance = 0;
+    double income = 0; // salary size; 0 for merchants
+};
+
+inline double cents(double v) { return std::round(v * 100.0) / 100.0; }
+
+bool check(sqlite3 *db, int rc, const char *what)
+{
+    if (rc == SQLITE_OK || rc == SQLITE_DONE || rc == SQLITE_ROW)
+        return true;
+    std::cerr << "[SQL ERR] " << what << ": " << sqlite3_errmsg(db) << "\n";
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, o))
+        return 2;
+
+    std::ifstream schema_in(o.schema);
+    if (!schema_in)
+    {
+        std::cerr << "cannot read schema " << o.schema << "\n";
+        return 1;
+    }
+    std::stringstream schema;
+    schema << schema_in.rdbuf();
+
+    struct stat st;
+    if (stat(o.out.c_str(), &st) == 0)
+    {
+        if (!o.force)
+        {
+            std::cerr << o.out << " exists; pass --force to replace it\n";
+            return 1;
+        }
+        for (const char *suffix : {"", "-wal", "-shm", "-journal"})
+            std::remove((o.out + suffix).c_str());
+    }
+
+    sqlite3 *db = nullptr;
+    if (sqlite3_open(o.out.c_str(), &db) != SQLITE_OK)
+    {
+        std::cerr << "cannot open " << o.out << "\n";
+        return 1;
+    }
+    // nothing to protect until the load finishes: no journal, no fsync, and
+    // the secondary indexes are built once at the end instead of row by row
+    exec_sql(db, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF; PRAGMA locking_mode=EXCLUSIVE;"
+                 "PRAGMA temp_store=MEMORY; PRAGMA cache_size=-262144;");
+    if (exec_sql(db, schema.str().c_str()) != SQLITE_OK)
+        return 1;
+    for (const char *col : {"name", "phone", "address"})
+        if (!has_column(db, "users", col))
+            exec_sql(db, (std::string("ALTER TABLE users ADD COLUMN ") + col + " TEXT;").c_str());
+    exec_sql(db, "DROP INDEX IF EXISTS idx_transactions_from; DROP INDEX IF EXISTS idx_transactions_to;");
+
+    std::mt19937_64 rng(o.seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    auto t0 = std::chrono::steady_clock::now();
+    std::time_t end = std::time(nullptr);
+    std::time_t start = end - (std::time_t)(o.years * 365.25 * 86400);
+    TimeFormatter fmt;
+
+    exec_sql(db, "BEGIN;");
+
+    // --- users and accounts; merchants come after the customers
+    sqlite3_stmt *ins_user = nullptr, *ins_acc = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO users (id, email, password_hash, salt, created_at, name) VALUES (?, ?, ?, ?, ?, ?)", -1, &ins_user, nullptr);
+    sqlite3_prepare_v2(db, "INSERT INTO accounts (user_id, account_number, account_type, balance, created_at) VALUES (?, ?, ?, ?, ?)", -1, &ins_acc, nullptr);
+
+    std::vector<Account> accounts;
+    std::poisson_distribution<int> extra_accounts(o.accounts - 1);
+    std::lognormal_distribution<double> income(std::log(2700.0), 0.5);
+    static const char *types[] = {"Savings", "Checking", "Credit"};
+    long total_users = o.users + o.merchants;
+    for (long u = 1; u <= total_users; ++u)
+    {
+        bool merchant = u > o.users;
+        std::string email = merchant ? "merchant" + std::to_string(u - o.users) + "@example.com"
+                                     : "user" + std::to_string(u) + "@example.com";
+        std::string name = merchant ? "Merchant " + std::to_string(u - o.users) : "User " + std::to_string(u);
+        char salt[17];
+        hex16(mix64(o.seed ^ (uint64_t)u), salt);
+        std::string hash = sha256(std::string(salt, 16) + o.password);
+        // sign-ups spread over the year before the ledger starts
+        std::time_t created = start - (std::time_t)(unit(rng) * 365 * 86400);
+        std::string created_s = fmt(created);
+        sqlite3_bind_int64(ins_user, 1, u);
+        sqlite3_bind_text(ins_user, 2, email.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(ins_user, 3, hash.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(ins_user, 4, salt, 16, SQLITE_STATIC);
+        sqlite3_bind_text(ins_user, 5, created_s.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(ins_user, 6, name.c_str(), -1, SQLITE_STATIC);
+        if (!check(db, sqlite3_step(ins_user), "insert user"))
+            return 1;
+        sqlite3_reset(ins_user);
+
+        int n = merchant ? 1 : 1 + extra_accounts(rng);
+        double user_income = income(rng);
+        for (int k = 0; k < n; ++k)
+        {
+            Account a;
+            // 8 digits, outside the 6-7 digit range /create_account hands out
+            a.number = "ACC" + std::to_string(10000000 + accounts.size());
+            a.user = u;
+            a.income = merchant ? 0 : cents(user_income / n);
+            sqlite3_bind_int64(ins_acc, 1, u);
+            sqlite3_bind_text(ins_acc, 2, a.number.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_text(ins_acc, 3, merchant ? "Checking" : types[k % 3], -1, SQLITE_STATIC);
+            sqlite3_bind_double(ins_acc, 4, 0);
+            sqlite3_bind_text(ins_acc, 5, created_s.c_str(), -1, SQLITE_STATIC);
+            if (!check(db, sqlite3_step(ins_acc), "insert account"))
+                return 1;
+            sqlite3_reset(ins_acc);
+            accounts.push_back(std::move(a));
+        }
+    }
+    sqlite3_finalize(ins_user);
+    sqlite3_finalize(ins_acc);
+    size_t n_customer = accounts.size() - (size_t)o.merchants;
+
+    // --- ledger, generated in time order so running balances are exact
+    double months = o.years * 12;
+    uint64_t n_tx = (uint64_t)(n_customer * o.tx_per_month * months);
+    double mean_gap = (double)(end - start) / (double)std::max<uint64_t>(n_tx, 1);
+    std::exponential_distribution<double> gap(1.0 / mean_gap);
+    std::uniform_int_distribution<size_t> pick(0, n_customer - 1);
+    Zipf merchant_rank(o.merchants, o.merchant_zipf);
+    std::lognormal_distribution<double> purchase(std::log(25.0), 1.0);
+    std::lognormal_distribution<double> p2p(std::log(55.0), 0.9);
+    std::lognormal_distribution<double> cash_in(std::log(80.0), 0.7);
+    std::vector<size_t> first_account(total_users + 1, SIZE_MAX);
+    for (size_t i = 0; i < accounts.size(); ++i)
+        if (first_account[accounts[i].user] == SIZE_MAX)
+            first_account[accounts[i].user] = i;
+
+    // rows go in kRows at a time: with AUTOINCREMENT every INSERT statement
+    // also rewrites sqlite_sequence, which costs about as much as the row
+    // itself when inserting one row per statement
+    constexpr int kRows = 128, kCols = 7;
+    struct TxRow
+    {
+        char uuid[17];
+        char ts[20];
+        const Account *from, *to;
+        double amount, from_after, to_after;
+    };
+    std::vector<TxRow> pending;
+    pending.reserve(kRows);
+    auto prepare_insert = [&](int rows)
+    {
+        std::string sql = "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after) VALUES ";
+        for (int r = 0; r < rows; ++r)
+            sql += r ? ",(?,?,?,?,?,?,?)" : "(?,?,?,?,?,?,?)";
+        sqlite3_stmt *stmt = nullptr;
+        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+        return stmt;
+    };
+    sqlite3_stmt *ins_batch = prepare_insert(kRows), *ins_one = prepare_insert(1);
+    auto flush = [&]() -> bool
+    {
+        if (pending.empty())
+            return true;
+        bool full = pending.size() == (size_t)kRows;
+        for (size_t start_row = 0; start_row < pending.size(); start_row += full ? kRows : 1)
+        {
+            sqlite3_stmt *stmt = full ? ins_batch : ins_one;
+            for (int r = 0; r < (full ? kRows : 1); ++r)
+            {
+                const TxRow &row = pending[start_row + r];
+                int p = r * kCols;
+                sqlite3_bind_text(stmt, p + 1, row.uuid, 16, SQLITE_STATIC);
+                if (row.from)
+                    sqlite3_bind_text(stmt, p + 2, row.from->number.c_str(), (int)row.from->number.size(), SQLITE_STATIC);
+                else
+                    sqlite3_bind_null(stmt, p + 2);
+                if (row.to)
+                    sqlite3_bind_text(stmt, p + 3, row.to->number.c_str(), (int)row.to->number.size(), SQLITE_STATIC);
+                else
+                    sqlite3_bind_null(stmt, p + 3);
+                sqlite3_bind_double(stmt, p + 4, row.amount);
+                sqlite3_bind_text(stmt, p + 5, row.ts, 19, SQLITE_STATIC);
+                if (row.from)
+                    sqlite3_bind_double(stmt, p + 6, row.from_after);
+                else
+                    sqlite3_bind_null(stmt, p + 6);
+                if (row.to)
+                    sqlite3_bind_double(stmt, p + 7, row.to_after);
+                else
+                    sqlite3_bind_null(stmt, p + 7);
+            }
+            int rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            if (!check(db, rc, "insert transactions"))
+                return false;
+        }
+        pending.clear();
+        return true;
+    };
+
+    uint64_t written = 0;
+    double t = (double)start;
+    auto emit = [&](Account *from, Account *to, double amount) -> bool
+    {
+        amount = cents(amount);
+        if (from)
+            from->balance = cents(from->balance - amount);
+        if (to)
+            to->balance = cents(to->balance + amount);
+        TxRow row;
+        hex16(mix64(o.seed * 0x100000001b3ULL + written), row.uuid);
+        std::memcpy(row.ts, fmt((std::time_t)t), 20);
+        row.from = from;
+        row.to = to;
+        row.amount = amount;
+        row.from_after = from ? from->balance : 0;
+        row.to_after = to ? to->balance : 0;
+        pending.push_back(row);
+        if (pending.size() == (size_t)kRows && !flush())
+            return false;
+        if (++written % 1000000 == 0)
+        {
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            std::cerr << "  " << written / 1000000 << "M ledger rows, " << (long)(written / s) << " rows/s\n";
+        }
+        return true;
+    };
+
+    // opening deposit of one salary per account
+    for (size_t i = 0; i < n_customer; ++i)
+        if (!emit(nullptr, &accounts[i], accounts[i].income))
+            return 1;
+
+    for (uint64_t i = 0; i < n_tx; ++i)
+    {
+        t = std::min(t + gap(rng), (double)end);
+        Account &a = accounts[pick(rng)];
+        double r = unit(rng);
+        Account *from = nullptr, *to = nullptr;
+        double amount;
+        if (r < 0.08)
+        {
+            to = &a;
+            amount = a.income;
+        }
+        else if (r < 0.12)
+        {
+            to = &a;
+            amount = cash_in(rng);
+        }
+        else if (r < 0.22)
+        {
+            from = &a;
+            amount = 20.0 * (1 + (int)(unit(rng) * 20));
+        }
+        else if (r < 0.80)
+        {
+            from = &a;
+            to = &accounts[n_customer + merchant_rank(rng)];
+            amount = purchase(rng);
+        }
+        else
+        {
+            from = &a;
+            size_t own = first_account[a.user];
+            bool same_user = unit(rng) < 0.33 && own + 1 < accounts.size() && accounts[own + 1].user == a.user;
+            to = same_user ? &accounts[&a == &accounts[own] ? own + 1 : own] : &accounts[pick(rng)];
+            if (to == from)
+                to = &accounts[(size_t)(to - accounts.data() + 1) % n_customer];
+            amount = p2p(rng);
+        }
+        amount = std::max(0.01, cents(amount));
+        if (from && from->balance < amount)
+        {
+            from = nullptr;
+            to = &a;
+            amount = a.income;
+        }
+        if (!emit(from, to, amount))
+            return 1;
+    }
+    if (!flush())
+        return 1;
+    sqlite3_finalize(ins_batch);
+    sqlite3_finalize(ins_one);
+
+    // --- final balances
+    sqlite3_stmt *set_bal = nullptr;
+    sqlite3_prepare_v2(db, "UPDATE accounts SET balance = ? WHERE id = ?", -1, &set_bal, nullptr);
+    for (size_t i = 0; i < accounts.size(); ++i)
+    {
+        sqlite3_bind_double(set_bal, 1, accounts[i].balance);
+        sqlite3_bind_int64(set_bal, 2, (long long)i + 1);
+        sqlite3_step(set_bal);
+        sqlite3_reset(set_bal);
+    }
+    sqlite3_finalize(set_bal);
+    if (!check(db, exec_sql(db, "COMMIT;"), "commit"))
+        return 1;
+    double load_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // same indexes and columns the server expects, then planner statistics
+    upgrade_schema(db);
+    exec_sql(db, "ANALYZE;");
+    exec_sql(db, "PRAGMA locking_mode=NORMAL; PRAGMA journal_mode=WAL;");
+    sqlite3_close(db);
+    double total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    stat(o.out.c_str(), &st);
+    std::cout << std::fixed << std::setprecision(1)
+              << o.out << ": " << total_users << " users (" << o.merchants << " merchants), "
+              << accounts.size() << " accounts, " << written << " transactions\n"
+              << "load " << load_s << " s (" << (long)(written / load_s) << " ledger rows/s), "
+              << "indexes + analyze " << total_s - load_s << " s, "
+              << st.st_size / (1024.0 * 1024.0) << " MiB\n";
+    return 0;
+}
@@ -0,0 +1,347 @@
+// loadgen.cpp - load generator for the MiniBank API
+// Build: g++ loadgen.cpp -std=c++17 -pthread -o loadgen
+//
+// Closed loop (default): --threads workers issue requests back to back.
+// Open loop (--rate N): requests are scheduled as a Poisson process of N/s
+// and latency is measured from the scheduled start, so a stalled server is
+// charged for the requests it delayed (coordinated-omission correction).
+//
+//   ./loadgen --duration 30 --threads 16 --users 200 --zipf 1.1
+//   ./loadgen --rate 2000 --mix deposit=40,transfer=40,accounts=20
+//   ./loadgen --unix /run/minibank.sock    # compare against TCP loopback
+//   ./loadgen --accept-encoding gzip       # server-side cost of compressed reads
+
+#include "httplib.h"
+#include "json.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+enum Op
+{
+    SIGNUP,
+    LOGIN,
+    DEPOSIT,
+    WITHDRAW,
+    TRANSFER,
+    ACCOUNTS,
+    TRANSACTIONS,
+    NUM_OPS
+};
+static const char *op_names[NUM_OPS] = {"signup", "login", "deposit", "withdraw", "transfer", "accounts", "transactions"};
+
+struct Options
+{
+    std::string host = "localhost";
+    int port = 8080;
+    std::string unix_path; // MINIBANK_UNIX_SOCKET instead of TCP
+    std::string accept_encoding; // sent as is; read bodies are never decoded
+    int threads = 16;
+    int users = 100;
+    double duration = 10;
+    double rate = 0; // 0 = closed loop
+    double zipf = 1.0;
+    std::string mix = "deposit=25,withdraw=10,transfer=20,accounts=25,transactions=15,login=4,signup=1";
+    bool json_out = false;
+};
+
+struct User
+{
+    int id;
+    std::string email;
+    std::vector<std::string> accounts;
+};
+
+// Zipf(s) over ranks 0..n-1 by inverse CDF; rank 0 is the hottest
+class Zipf
+{
+public:
+    Zipf(size_t n, double s)
+    {
+        cdf_.resize(n);
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            cdf_[i] = (sum += 1.0 / std::pow((double)(i + 1), s));
+        for (double &c : cdf_)
+            c /= sum;
+    }
+    template <class Rng>
+    size_t operator()(Rng &rng) const
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::min(cdf_.size() - 1, (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin()));
+    }
+
+private:
+    std::vector<double> cdf_;
+};
+
+// per-worker results, merged at the end
+struct Samples
+{
+    std::vector<uint64_t> lat_us[NUM_OPS];
+    uint64_t errors[NUM_OPS] = {};   // transport failure or HTTP >= 400
+    uint64_t rejected[NUM_OPS] = {}; // 200 with status != ok (e.g. insufficient_funds)
+};
+
+static bool parse_args(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--host")
+            o.host = next();
+        else if (a == "--port")
+            o.port = std::stoi(next());
+        else if (a == "--unix")
+            o.unix_path = next();
+        else if (a == "--accept-encoding")
+            o.accept_encoding = next();
+        else if (a == "--threads")
+            o.threads = std::stoi(next());
+        else if (a == "--users")
+            o.users = std::stoi(next());
+        else if (a == "--duration")
+            o.duration = std::stod(next());
+        else if (a == "--rate")
+            o.rate = std::stod(next());
+        else if (a == "--zipf")
+            o.zipf = std::stod(next());
+        else if (a == "--mix")
+            o.mix = next();
+        else if (a == "--json")
+            o.json_out = true;
+        else
+        {
+            std::cerr << "usage: loadgen [--host H] [--port P | --unix PATH] [--threads N] [--users N] [--duration S]\n"
+                         "               [--rate REQ_PER_S] [--zipf S] [--mix op=w,...] [--accept-encoding gzip] [--json]\n"
+                         "ops: signup login deposit withdraw transfer accounts transactions\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<double> parse_mix(const std::string &mix)
+{
+    std::vector<double> w(NUM_OPS, 0);
+    std::stringstream ss(mix);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        double weight = eq == std::string::npos ? 1 : std::stod(item.substr(eq + 1));
+        for (int op = 0; op < NUM_OPS; ++op)
+            if (name == op_names[op])
+                w[op] = weight;
+    }
+    return w;
+}
+
+static httplib::Client make_client(const Options &o)
+{
+    httplib::Client cli(o.unix_path.empty() ? o.host : o.unix_path, o.port);
+    if (!o.unix_path.empty())
+        cli.set_address_family(AF_UNIX);
+    if (!o.accept_encoding.empty())
+    {
+        // without this httplib answers a coded body it was built unable to decode with a 415
+        cli.set_decompress(false);
+        cli.set_default_headers({{"Accept-Encoding", o.accept_encoding}});
+    }
+    return cli;
+}
+
+static json post(httplib::Client &cli, const std::string &path, const json &body)
+{
+    auto r = cli.Post(path, body.dump(), "application/json");
+    if (!r || r->status != 200)
+        return json();
+    try
+    {
+        return json::parse(r->body);
+    }
+    catch (...)
+    {
+        return json();
+    }
+}
+
+// signup, login and fund `n` users with two accounts each
+static std::vector<User> setup_users(const Options &o, const std::string &run)
+{
+    std::vector<User> users(o.users);
+    std::atomic<int> next{0};
+    std::vector<std::thread> ts;
+    for (int t = 0; t < std::min(o.threads, o.users); ++t)
+        ts.emplace_back([&]()
+                        {
+            httplib::Client cli = make_client(o);
+            for (int i; (i = next++) < o.users;) {
+                User &u = users[i];
+                u.email = "lg-" + run + "-" + std::to_string(i) + "@bench";
+                post(cli, "/signup", {{"email", u.email}, {"password", "pw"}});
+                json l = post(cli, "/login", {{"email", u.email}, {"password", "pw"}});
+                u.id = l.value("user_id", 0);
+                for (const char *type : {"Savings", "Checking"}) {
+                    json a = post(cli, "/create_account", {{"user_id", u.id}, {"type", type}});
+                    if (a.value("status", "") == "ok") {
+                        u.accounts.push_back(a["account_number"]);
+                        post(cli, "/deposit", {{"account_number", u.accounts.back()}, {"amount", 1000000.0}});
+                    }
+                }
+            } });
+    for (auto &t : ts)
+        t.join();
+    users.erase(std::remove_if(users.begin(), users.end(), [](const User &u)
+                               { return u.id == 0 || u.accounts.empty(); }),
+                users.end());
+    return users;
+}
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, o))
+        return 2;
+    std::vector<double> weights = parse_mix(o.mix);
+
+    std::string run = std::to_string(std::chrono::system_clock::now().time_since_epoch().count() % 100000000);
+    std::cerr << "setting up " << o.users << " users..." << std::endl;
+    std::vector<User> users = setup_users(o, run);
+    if (users.empty())
+    {
+        std::cerr << "setup failed: is the server running on " << (o.unix_path.empty() ? o.host + ":" + std::to_string(o.port) : o.unix_path) << "?\n";
+        return 1;
+    }
+    std::vector<std::pair<int, std::string>> accounts; // (user index, account)
+    for (size_t i = 0; i < users.size(); ++i)
+        for (const auto &a : users[i].accounts)
+            accounts.push_back({(int)i, a});
+    Zipf user_pick(users.size(), o.zipf), acc_pick(accounts.size(), o.zipf);
+
+    // open-loop arrival schedule shared by all workers
+    std::mutex sched_mu;
+    std::mt19937_64 sched_rng(42);
+    std::exponential_distribution<double> gap(o.rate > 0 ? o.rate : 1);
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(100);
+    Clock::time_point deadline = start + std::chrono::microseconds((long long)(o.duration * 1e6));
+    double next_arrival_s = 0;
+    std::atomic<int> signups{0};
+
+    std::vector<Samples> results(o.threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < o.threads; ++t)
+        workers.emplace_back([&, t]()
+                             {
+            httplib::Client cli = make_client(o);
+            cli.set_keep_alive(true);
+            cli.set_tcp_nodelay(true);
+            std::mt19937_64 rng(1000 + t);
+            std::discrete_distribution<int> pick_op(weights.begin(), weights.end());
+            Samples &s = results[t];
+            std::this_thread::sleep_until(start);
+            while (true) {
+                Clock::time_point intended = Clock::now();
+                if (o.rate > 0) {
+                    std::lock_guard<std::mutex> lk(sched_mu);
+                    next_arrival_s += gap(sched_rng);
+                    intended = start + std::chrono::microseconds((long long)(next_arrival_s * 1e6));
+                }
+                if (intended >= deadline) break;
+                std::this_thread::sleep_until(intended);
+
+                int op = pick_op(rng);
+                const User &u = users[user_pick(rng)];
+                const auto &acc = accounts[acc_pick(rng)].second;
+                httplib::Result r;
+                switch (op) {
+                case SIGNUP:
+                    r = cli.Post("/signup", json{{"email", "lg-" + run + "-new-" + std::to_string(signups++) + "@bench"}, {"password", "pw"}}.dump(), "application/json");
+                    break;
+                case LOGIN:
+                    r = cli.Post("/login", json{{"email", u.email}, {"password", "pw"}}.dump(), "application/json");
+                    break;
+                case DEPOSIT:
+                    r = cli.Post("/deposit", json{{"account_number", acc}, {"amount", 10.0}}.dump(), "application/json");
+                    break;
+                case WITHDRAW:
+                    r = cli.Post("/withdraw", json{{"account_number", acc}, {"amount", 5.0}}.dump(), "application/json");
+                    break;
+                case TRANSFER: {
+                    const auto &to = accounts[acc_pick(rng)].second;
+                    r = cli.Post("/transfer", json{{"from", acc}, {"to", to}, {"amount", 1.0}}.dump(), "application/json");
+                    break;
+                }
+                case ACCOUNTS:
+                    r = cli.Get("/accounts/" + std::to_string(u.id));
+                    break;
+                case TRANSACTIONS:
+                    r = cli.Get("/transactions/" + acc);
+                    break;
+                }
+                uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - intended).count();
+                s.lat_us[op].push_back(us);
+                if (!r || r->status >= 400) s.errors[op]++;
+                else if (op != ACCOUNTS && op != TRANSACTIONS && r->body.find("\"status\":\"ok\"") == std::string::npos) s.rejected[op]++;
+            } });
+    for (auto &w : workers)
+        w.join();
+    double elapsed = std::chrono::duration<double>(std::min(Clock::now(), deadline) - start).count();
+
+    json report = json::array();
+    for (int op = 0; op < NUM_OPS; ++op)
+    {
+        std::vector<uint64_t> all;
+        uint64_t errors = 0, rejected = 0;
+        for (const Samples &s : results)
+        {
+            all.insert(all.end(), s.lat_us[op].begin(), s.lat_us[op].end());
+            errors += s.errors[op];
+            rejected += s.rejected[op];
+        }
+        if (all.empty())
+            continue;
+        std::sort(all.begin(), all.end());
+        auto pct = [&](double q)
+        { return all[std::min(all.size() - 1, (size_t)(q * (double)all.size()))] / 1000.0; };
+        report.push_back({{"route", op_names[op]}, {"count", all.size()}, {"errors", errors}, {"rejected", rejected}, {"rps", all.size() / elapsed}, {"p50_ms", pct(0.50)}, {"p99_ms", pct(0.99)}, {"p999_ms", pct(0.999)}, {"max_ms", all.back() / 1000.0}});
+    }
+
+    if (o.json_out)
+    {
+        std::cout << json{{"mode", o.rate > 0 ? "open" : "closed"}, {"rate", o.rate}, {"threads", o.threads}, {"users", users.size()}, {"duration_s", elapsed}, {"routes", report}}.dump(2) << "\n";
+        return 0;
+    }
+    std::cout << (o.rate > 0 ? "open loop, " + std::to_string((int)o.rate) + " req/s" : "closed loop") << ", " << o.threads << " threads, "
+              << users.size() << " users, zipf " << o.zipf << ", " << std::fixed << std::setprecision(1) << elapsed << " s\n";
+    std::cout << std::left << std::setw(14) << "route" << std::right << std::setw(9) << "count" << std::setw(8) << "errors" << std::setw(9) << "rejected"
+              << std::setw(10) << "req/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << "\n";
+    double total = 0;
+    for (const json &r : report)
+    {
+        total += r["rps"].get<double>();
+        std::cout << std::left << std::setw(14) << r["route"].get<std::string>() << std::right << std::setw(9) << r["count"].get<size_t>()
+                  << std::setw(8) << r["errors"].get<uint64_t>() << std::setw(9) << r["rejected"].get<uint64_t>()
+                  << std::setw(10) << std::setprecision(1) << r["rps"].get<double>() << std::setprecision(2)
+                  << std::setw(10) << r["p50_ms"].get<double>() << std::setw(10) << r["p99_ms"].get<double>() << std::setw(10) << r["p999_ms"].get<double>() << "\n";
+    }
+    std::cout << "total " << std::setprecision(1) << total << " req/s\n";
+    return 0;
+}
@@ -0,0 +1,670 @@
+// minibank.h - what the server and its tools (gen_dataset, bench, replay,
+// rpcbench) share, so a tool compiles only the parts it uses rather than
+// the whole server. Everything is inline: a tool that needs one helper
+// builds without unused-function warnings for the rest.
+#ifndef MINIBANK_H
+#define MINIBANK_H
+
+#include "httplib.h"
+#include "json.hpp"
+#include <sqlite3.h>
+#include <zlib.h>
+#ifdef MINIBANK_ZSTD
+#include <zstd.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+// --- time helper
+inline std::string now_iso()
+{
+    std::time_t t = std::time(nullptr);
+    char buf[64];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+    return std::string(buf);
+}
+
+// --- random hex
+inline std::string random_hex(int len = 32)
+{
+    static std::mt19937_64 rng((unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    static const char *hex = "0123456789abcdef";
+    std::string s;
+    s.reserve(len);
+    for (int i = 0; i < len; ++i)
+        s.push_back(hex[rng() & 0xF]);
+    return s;
+}
+
+// --- small SHA256 (compact) - production: use libsodium/OpenSSL
+typedef unsigned int uint32;
+typedef unsigned long long uint64;
+inline uint32 rotr(uint32 x, uint32 n) { return (x >> n) | (x << (32 - n)); }
+inline uint32 ch(uint32 x, uint32 y, uint32 z) { return (x & y) ^ (~x & z); }
+inline uint32 maj(uint32 x, uint32 y, uint32 z) { return (x & y) ^ (x & z) ^ (y & z); }
+inline uint32 bsig0(uint32 x) { return rotr(x, 2) ^ rotr(x, 13) ^ rotr(x, 22); }
+inline uint32 bsig1(uint32 x) { return rotr(x, 6) ^ rotr(x, 11) ^ rotr(x, 25); }
+inline uint32 ssig0(uint32 x) { return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3); }
+inline uint32 ssig1(uint32 x) { return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10); }
+
+inline std::string sha256(const std::string &msg)
+{
+    static const uint32 k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76f51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint64 bitlen = (uint64)msg.size() * 8ULL;
+    std::vector<unsigned char> data(msg.begin(), msg.end());
+    data.push_back(0x80);
+    while ((data.size() * 8) % 512 != 448)
+        data.push_back(0x00);
+    for (int i = 7; i >= 0; --i)
+        data.push_back((bitlen >> (i * 8)) & 0xFF);
+
+    uint32 h0 = 0x6a09e667, h1 = 0xbb67ae85, h2 = 0x3c6ef372, h3 = 0xa54ff53a;
+    uint32 h4 = 0x510e527f, h5 = 0x9b05688c, h6 = 0x1f83d9ab, h7 = 0x5be0cd19;
+
+    for (size_t chunk = 0; chunk < data.size(); chunk += 64)
+    {
+        uint32 w[64];
+        memset(w, 0, sizeof(w));
+        for (int i = 0; i < 16; ++i)
+        {
+            w[i] = ((uint32)data[chunk + i * 4] << 24) |
+                   ((uint32)data[chunk + i * 4 + 1] << 16) |
+                   ((uint32)data[chunk + i * 4 + 2] << 8) |
+                   ((uint32)data[chunk + i * 4 + 3]);
+        }
+        for (int i = 16; i < 64; ++i)
+            w[i] = ssig1(w[i - 2]) + w[i - 7] + ssig0(w[i - 15]) + w[i - 16];
+
+        uint32 a = h0, b = h1, c = h2, d = h3, e = h4, f = h5, g = h6, h = h7;
+        for (int i = 0; i < 64; ++i)
+        {
+            uint32 T1 = h + bsig1(e) + ch(e, f, g) + k[i] + w[i];
+            uint32 T2 = bsig0(a) + maj(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + T1;
+            d = c;
+            c = b;
+            b = a;
+            a = T1 + T2;
+        }
+        h0 += a;
+        h1 += b;
+        h2 += c;
+        h3 += d;
+        h4 += e;
+        h5 += f;
+        h6 += g;
+        h7 += h;
+    }
+
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0') << std::nouppercase;
+    auto write32 = [&](uint32 x)
+    { oss << std::setw(8) << x; };
+    write32(h0);
+    write32(h1);
+    write32(h2);
+    write32(h3);
+    write32(h4);
+    write32(h5);
+    write32(h6);
+    write32(h7);
+    return oss.str();
+}
+
+// small exec helper (no callback)
+inline int exec_sql(sqlite3 *db, const char *sql)
+{
+    char *err = nullptr;
+    int rc = sqlite3_exec(db, sql, nullptr, nullptr, &err);
+    if (rc != SQLITE_OK && err)
+    {
+        std::cerr << "[SQL ERR] " << err << std::endl;
+        sqlite3_free(err);
+    }
+    return rc;
+}
+
+// safe helper to convert possibly-NULL column text to std::string
+inline std::string to_str(const unsigned char *t)
+{
+    return t ? std::string(reinterpret_cast<const char *>(t)) : std::string("");
+}
+
+// --- schema upgrades for databases created before the running-balance columns
+inline bool has_column(sqlite3 *db, const char *table, const char *column)
+{
+    sqlite3_stmt *stmt = nullptr;
+    std::string sql = std::string("PRAGMA table_info(") + table + ")";
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        found = to_str(sqlite3_column_text(stmt, 1)) == column;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Replays the ledger once to fill from/to_balance_after on rows written
+// before those columns existed. Accounts are independent, so the replay is
+// split across threads by account; the results are written back in a
+// single transaction since SQLite has one writer anyway.
+inline size_t backfill_running_balances(sqlite3 *db)
+{
+    struct Row
+    {
+        long long id;
+        std::string from, to;
+        double amount;
+        bool need_from, need_to;
+        double from_after = 0, to_after = 0;
+    };
+    std::vector<Row> rows;
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, "SELECT id, from_account, to_account, amount, from_balance_after IS NULL, to_balance_after IS NULL FROM transactions ORDER BY id", -1, &stmt, nullptr);
+    bool pending = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        Row r;
+        r.id = sqlite3_column_int64(stmt, 0);
+        r.from = to_str(sqlite3_column_text(stmt, 1));
+        r.to = to_str(sqlite3_column_text(stmt, 2));
+        r.amount = sqlite3_column_double(stmt, 3);
+        r.need_from = !r.from.empty() && sqlite3_column_int(stmt, 4);
+        r.need_to = !r.to.empty() && sqlite3_column_int(stmt, 5);
+        pending = pending || r.need_from || r.need_to;
+        rows.push_back(std::move(r));
+    }
+    sqlite3_finalize(stmt);
+    if (!pending)
+        return 0;
+
+    // each leg (row, side) belongs to exactly one account, so workers that
+    // own disjoint accounts never write the same field
+    unsigned n = std::max(1u, std::thread::hardware_concurrency());
+    std::hash<std::string> h;
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < n; ++w)
+        workers.emplace_back([&, w]()
+                             {
+            std::unordered_map<std::string, double> bal;
+            for (Row &r : rows) {
+                if (!r.from.empty() && h(r.from) % n == w) r.from_after = (bal[r.from] -= r.amount);
+                if (!r.to.empty() && h(r.to) % n == w) r.to_after = (bal[r.to] += r.amount);
+            } });
+    for (auto &t : workers)
+        t.join();
+
+    size_t updated = 0;
+    exec_sql(db, "BEGIN IMMEDIATE;");
+    sqlite3_prepare_v2(db, "UPDATE transactions SET from_balance_after = CASE WHEN ?1 THEN ?2 ELSE from_balance_after END, to_balance_after = CASE WHEN ?3 THEN ?4 ELSE to_balance_after END WHERE id = ?5", -1, &stmt, nullptr);
+    for (const Row &r : rows)
+    {
+        if (!r.need_from && !r.need_to)
+            continue;
+        sqlite3_bind_int(stmt, 1, r.need_from);
+        sqlite3_bind_double(stmt, 2, r.from_after);
+        sqlite3_bind_int(stmt, 3, r.need_to);
+        sqlite3_bind_double(stmt, 4, r.to_after);
+        sqlite3_bind_int64(stmt, 5, r.id);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        ++updated;
+    }
+    sqlite3_finalize(stmt);
+    exec_sql(db, "COMMIT;");
+    return updated;
+}
+
+inline void upgrade_schema(sqlite3 *db)
+{
+    exec_sql(db, "CREATE TABLE IF NOT EXISTS audit_logs (id INTEGER PRIMARY KEY AUTOINCREMENT, user_id INTEGER, action TEXT NOT NULL, details TEXT, created_at TEXT NOT NULL);");
+    if (!has_column(db, "transactions", "from_balance_after"))
+        exec_sql(db, "ALTER TABLE transactions ADD COLUMN from_balance_after REAL;");
+    if (!has_column(db, "transactions", "to_balance_after"))
+        exec_sql(db, "ALTER TABLE transactions ADD COLUMN to_balance_after REAL;");
+    exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_transactions_from ON transactions(from_account);");
+    exec_sql(db, "CREATE INDEX IF NOT EXISTS idx_transactions_to ON transactions(to_account);");
+    size_t n = backfill_running_balances(db);
+    if (n)
+        std::cout << "Backfilled running balances on " << n << " ledger rows\n";
+}
+
+// --- request tracing spans
+// A request's record of named phase timings (parse, lock, sql.*, serialize).
+// The server's Tracer installs one per request in t_trace; with none
+// installed, as in the tools, a span only reads the clock.
+struct TraceRecord
+{
+    struct Phase
+    {
+        const char *name;
+        uint64_t us;
+        uint32_t count;
+    };
+    static constexpr size_t kMaxPhases = 16;
+
+    uint64_t id = 0;
+    std::string route;
+    std::string started; // wall clock, for humans
+    uint64_t total_us = 0;
+    Phase phases[kMaxPhases];
+    size_t n = 0;
+
+    // repeated phases (e.g. several SELECTs) are merged by name
+    void add(const char *name, uint64_t us)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (phases[i].name == name || strcmp(phases[i].name, name) == 0)
+            {
+                phases[i].us += us;
+                phases[i].count++;
+                return;
+            }
+        if (n < kMaxPhases)
+            phases[n++] = Phase{name, us, 1};
+    }
+
+    json to_json() const
+    {
+        json j;
+        j["id"] = id;
+        j["route"] = route;
+        j["started"] = started;
+        j["total_us"] = total_us;
+        json ph = json::object();
+        for (size_t i = 0; i < n; ++i)
+            ph[phases[i].name] = {{"us", phases[i].us}, {"count", phases[i].count}};
+        j["phases"] = ph;
+        return j;
+    }
+};
+
+// the record of the request running on this thread, if any
+inline thread_local TraceRecord *t_trace = nullptr;
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) : name_(name), t0_(std::chrono::steady_clock::now()) {}
+    ~TraceSpan()
+    {
+        if (t_trace)
+            t_trace->add(name_, (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0_).count());
+    }
+
+private:
+    const char *name_;
+    std::chrono::steady_clock::time_point t0_;
+};
+
+// --- wire encodings
+// Handlers build nlohmann::json values; on the wire they can be JSON (the
+// default), MessagePack or CBOR. Request bodies follow Content-Type and
+// responses follow Accept, taking the first supported type listed (q=0
+// excluded). the server's timed() records the choice for the handler's thread.
+enum class Wire
+{
+    Json,
+    MsgPack,
+    Cbor
+};
+
+inline thread_local Wire t_wire = Wire::Json;
+
+inline const char *wire_type(Wire w)
+{
+    return w == Wire::MsgPack ? "application/msgpack" : w == Wire::Cbor ? "application/cbor" : "application/json";
+}
+
+inline bool wire_of(std::string media, Wire &w)
+{
+    media = media.substr(0, media.find(';'));
+    size_t b = media.find_first_not_of(" \t"), e = media.find_last_not_of(" \t");
+    media = b == std::string::npos ? "" : media.substr(b, e - b + 1);
+    std::transform(media.begin(), media.end(), media.begin(), ::tolower);
+    if (media == "application/msgpack" || media == "application/x-msgpack" || media == "application/vnd.msgpack")
+        w = Wire::MsgPack;
+    else if (media == "application/cbor")
+        w = Wire::Cbor;
+    else if (media == "application/json" || media == "application/*" || media == "*/*")
+        w = Wire::Json;
+    else
+        return false;
+    return true;
+}
+
+// Content-Encoding, negotiated from Accept-Encoding: the server's preference
+// among the codings the client accepts (q=0 excluded).
+enum class Coding
+{
+    Identity,
+    Gzip,
+    Deflate,
+    Zstd
+};
+
+inline thread_local Coding t_coding = Coding::Identity;
+
+inline const char *coding_name(Coding c)
+{
+    return c == Coding::Gzip ? "gzip" : c == Coding::Deflate ? "deflate" : c == Coding::Zstd ? "zstd" : "identity";
+}
+
+inline std::string encode(const json &j, Wire w)
+{
+    std::string out;
+    if (w == Wire::MsgPack)
+        json::to_msgpack(j, out);
+    else if (w == Wire::Cbor)
+        json::to_cbor(j, out);
+    else
+        out = j.dump();
+    return out;
+}
+
+inline json parse_body(const httplib::Request &req)
+{
+    TraceSpan sp("parse");
+    Wire w = Wire::Json;
+    wire_of(req.get_header_value("Content-Type"), w);
+    if (w == Wire::MsgPack)
+        return json::from_msgpack(req.body);
+    if (w == Wire::Cbor)
+        return json::from_cbor(req.body);
+    return json::parse(req.body);
+}
+
+inline void send_json(httplib::Response &res, const json &j)
+{
+    TraceSpan sp("serialize");
+    res.set_content(encode(j, t_wire), wire_type(t_wire));
+    res.set_header("Vary", "Accept");
+}
+
+// --- response compression
+// One compressor per thread and coding, reset between bodies, so zlib's
+// ~270 KB of window and hash tables is allocated once per thread instead of
+// once per response. Streaming responses own theirs for the stream's life.
+class Compressor
+{
+public:
+#ifdef MINIBANK_ZSTD
+    static constexpr Coding kCodings[] = {Coding::Gzip, Coding::Deflate, Coding::Zstd};
+#else
+    static constexpr Coding kCodings[] = {Coding::Gzip, Coding::Deflate};
+#endif
+    // on JSON listings zlib's level 1 lands within about a point of level 6's
+    // ratio for well under half the CPU
+    static constexpr int kDefaultLevel = 1;
+
+    // level -1 = the library default (zlib 6, zstd 3)
+    Compressor(Coding c, int level)
+    {
+#ifdef MINIBANK_ZSTD
+        if (c == Coding::Zstd)
+        {
+            zc_ = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(zc_, ZSTD_c_compressionLevel, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+            return;
+        }
+#endif
+        // windowBits 15 + 16 writes a gzip wrapper; plain 15 the zlib wrapper,
+        // which is what HTTP calls "deflate"
+        std::memset(&z_, 0, sizeof(z_));
+        ok_ = deflateInit2(&z_, level, Z_DEFLATED, c == Coding::Gzip ? 31 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Compressor()
+    {
+#ifdef MINIBANK_ZSTD
+        if (zc_)
+            ZSTD_freeCCtx(zc_);
+#endif
+        if (ok_)
+            deflateEnd(&z_);
+    }
+
+    Compressor(const Compressor &) = delete;
+    Compressor &operator=(const Compressor &) = delete;
+
+    void reset()
+    {
+#ifdef MINIBANK_ZSTD
+        if (zc_)
+        {
+            ZSTD_CCtx_reset(zc_, ZSTD_reset_session_only);
+            return;
+        }
+#endif
+        if (ok_)
+            deflateReset(&z_);
+    }
+
+    // appends the compressed form of data to out. `last` ends the body;
+    // otherwise everything so far is flushed so the peer can decode it now
+    bool compress(const char *data, size_t n, bool last, std::string &out)
+    {
+        static constexpr size_t kChunk = 16384;
+#ifdef MINIBANK_ZSTD
+        if (zc_)
+        {
+            ZSTD_inBuffer in{data, n, 0};
+            for (;;)
+            {
+                size_t at = out.size();
+                out.resize(at + kChunk);
+                ZSTD_outBuffer ob{&out[at], kChunk, 0};
+                size_t left = ZSTD_compressStream2(zc_, &ob, &in, last ? ZSTD_e_end : ZSTD_e_flush);
+                out.resize(at + ob.pos);
+                if (ZSTD_isError(left))
+                    return false;
+                if (left == 0)
+                    return true;
+            }
+        }
+#endif
+        if (!ok_)
+            return false;
+        z_.next_in = (Bytef *)data;
+        z_.avail_in = (uInt)n;
+        int rc;
+        do
+        {
+            size_t at = out.size();
+            out.resize(at + kChunk);
+            z_.next_out = (Bytef *)&out[at];
+            z_.avail_out = (uInt)kChunk;
+            rc = deflate(&z_, last ? Z_FINISH : Z_SYNC_FLUSH);
+            out.resize(at + kChunk - z_.avail_out);
+            if (rc == Z_STREAM_ERROR)
+                return false;
+        } while (z_.avail_out == 0);
+        return !last || rc == Z_STREAM_END;
+    }
+
+private:
+    z_stream z_;
+    bool ok_ = false;
+#ifdef MINIBANK_ZSTD
+    ZSTD_CCtx *zc_ = nullptr;
+#endif
+};
+
+// --- traffic capture format (server writes, replay.cpp reads)
+// File: 8-byte magic "MBCAP01\n", u64 capture start (unix us), then records,
+// all in host byte order (replay on a host of the same endianness):
+//   u32 length of the rest of the record
+//   u64 arrival offset (us since start)   u32 handler duration (us)
+//   u16 HTTP status   u8 method (0 GET, 1 POST, 2 other)   u8 reserved
+//   u32 target length   u32 request body length   u32 response body length
+//   target (path and query), request body, response body (non-GET only;
+//   replay maps ids created by the server and checks outcomes with it)
+struct CaptureRecord
+{
+    uint64_t offset_us = 0;
+    uint32_t duration_us = 0;
+    uint16_t status = 0;
+    uint8_t method = 0;
+    std::string target, body, response;
+};
+
+inline constexpr char kCaptureMagic[8] = {'M', 'B', 'C', 'A', 'P', '0', '1', '\n'};
+
+// --- binary RPC
+// Length-prefixed frames on MINIBANK_RPC_PORT for internal callers that find
+// HTTP/JSON costs more than the ledger work. Integers are little-endian,
+// strings a u16 length and the bytes, amounts IEEE-754 doubles as in JSON.
+//   request: u32 length | u32 id | u8 op | fields
+//     1 deposit (account, amount)   2 withdraw (account, amount)
+//     3 transfer (from, to, amount) 4 balance (account)
+//   reply:   u32 length | u32 id | u8 status (0 ok, 1 error) | text | f64 balance
+// text is the tx_uuid of a money movement, or the same reason string the
+// HTTP API would return; balance is the account's (transfer: the sender's)
+// balance after the operation. Callers may pipeline any number of requests
+// on a connection; replies come back in request order.
+enum class RpcOp : uint8_t
+{
+    Deposit = 1,
+    Withdraw = 2,
+    Transfer = 3,
+    Balance = 4
+};
+
+struct RpcCall
+{
+    uint32_t id = 0;
+    uint8_t op = 0;
+    std::string account, to;
+    double amount = 0;
+};
+
+struct RpcReply
+{
+    uint32_t id = 0;
+    bool ok = false;
+    std::string text;
+    double balance = 0;
+};
+
+inline constexpr size_t kRpcMaxFrame = 4096;
+
+inline void rpc_put(std::string &out, const void *p, size_t n) { out.append((const char *)p, n); }
+
+inline void rpc_put_str(std::string &out, const std::string &v)
+{
+    uint16_t n = (uint16_t)std::min<size_t>(v.size(), 0xffff);
+    rpc_put(out, &n, 2);
+    out.append(v, 0, n);
+}
+
+inline bool rpc_take(const char *&p, const char *end, void *v, size_t n)
+{
+    if ((size_t)(end - p) < n)
+        return false;
+    std::memcpy(v, p, n);
+    p += n;
+    return true;
+}
+
+inline bool rpc_take_str(const char *&p, const char *end, std::string &v)
+{
+    uint16_t n;
+    if (!rpc_take(p, end, &n, 2) || (size_t)(end - p) < n)
+        return false;
+    v.assign(p, n);
+    p += n;
+    return true;
+}
+
+inline bool rpc_has_to(uint8_t op) { return op == (uint8_t)RpcOp::Transfer; }
+inline bool rpc_has_amount(uint8_t op) { return op != (uint8_t)RpcOp::Balance; }
+
+// one frame body (without the length); false if malformed. The id is set
+// whenever the frame is long enough to carry one, so the error can be answered
+inline bool rpc_take_call(const char *p, size_t n, RpcCall &c)
+{
+    const char *end = p + n;
+    if (!rpc_take(p, end, &c.id, 4) || !rpc_take(p, end, &c.op, 1) || c.op < 1 || c.op > 4 || !rpc_take_str(p, end, c.account))
+        return false;
+    if (rpc_has_to(c.op) && !rpc_take_str(p, end, c.to))
+        return false;
+    if (rpc_has_amount(c.op) && !rpc_take(p, end, &c.amount, 8))
+        return false;
+    return p == end;
+}
+
+inline void rpc_put_reply(std::string &out, const RpcReply &r)
+{
+    uint32_t len = (uint32_t)(4 + 1 + 2 + std::min<size_t>(r.text.size(), 0xffff) + 8);
+    uint8_t status = r.ok ? 0 : 1;
+    rpc_put(out, &len, 4);
+    rpc_put(out, &r.id, 4);
+    rpc_put(out, &status, 1);
+    rpc_put_str(out, r.text);
+    rpc_put(out, &r.balance, 8);
+}
+
+// the client halves: encode a call, decode a reply
+inline void rpc_put_call(std::string &out, const RpcCall &c)
+{
+    size_t at = out.size();
+    out.append(4, '\0');
+    rpc_put(out, &c.id, 4);
+    rpc_put(out, &c.op, 1);
+    rpc_put_str(out, c.account);
+    if (rpc_has_to(c.op))
+        rpc_put_str(out, c.to);
+    if (rpc_has_amount(c.op))
+        rpc_put(out, &c.amount, 8);
+    uint32_t len = (uint32_t)(out.size() - at - 4);
+    std::memcpy(&out[at], &len, 4);
+}
+
+inline bool rpc_take_reply(const char *p, size_t n, RpcReply &r)
+{
+    const char *end = p + n;
+    uint8_t status;
+    if (!rpc_take(p, end, &r.id, 4) || !rpc_take(p, end, &status, 1) || !rpc_take_str(p, end, r.text) || !rpc_take(p, end, &r.balance, 8))
+        return false;
+    r.ok = status == 0;
+    return p == end;
+}
+
+// length of the whole frame starting at buf[at] if it is all buffered, 0 if
+// not yet, SIZE_MAX if the length is out of range
+inline size_t rpc_frame(const std::string &buf, size_t at)
+{
+    uint32_t len;
+    if (buf.size() - at < 4)
+        return 0;
+    std::memcpy(&len, buf.data() + at, 4);
+    if (len < 5 || len > kRpcMaxFrame)
+        return SIZE_MAX;
+    return buf.size() - at - 4 < len ? 0 : 4 + (size_t)len;
+}
+
+#endif // MINIBANK_H
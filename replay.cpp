@@ -0,0 +1,348 @@
+// replay.cpp - replays a MINIBANK_CAPTURE_FILE capture against a server
+// Build: g++ replay.cpp -O2 -std=c++17 -lsqlite3 -lz -pthread -o replay
+//
+// Start the target server on a copy of the database as it was when the
+// capture began (or on a fresh one if the capture started empty), then:
+//
+//   ./replay --file capture.bin                  # original pace
+//   ./replay --file capture.bin --speed 0        # as fast as possible
+//   ./replay --file capture.bin --speed 4 --connections 8
+//
+// Requests are issued in captured order. Account numbers and user ids the
+// server hands out (create_account, login) differ between runs, so replay
+// learns the mapping from each response and rewrites later paths and bodies.
+// With one connection (the default) the replay is deterministic; with more,
+// requests still start in order but may complete out of order.
+//
+// Each response is checked against the captured one: same HTTP status and,
+// for POSTs, the same JSON "status" and "reason". Latency is measured from
+// each request's scheduled start. Exit status is 1 if anything mismatched.
+// /stream requests are skipped.
+
+#include "minibank.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string file;
+    std::string host = "localhost";
+    int port = 8080;
+    double speed = 1; // 0 = no pacing
+    int connections = 1;
+    bool json_out = false;
+    int show = 10; // mismatches printed in full
+};
+
+// reads the next record; false at end of file or on a truncated tail
+bool read_capture_record(std::FILE *f, CaptureRecord &r)
+{
+    uint32_t len;
+    if (std::fread(&len, 4, 1, f) != 1 || len < 28)
+        return false;
+    std::string buf(len, '\0');
+    if (std::fread(&buf[0], 1, len, f) != len)
+        return false;
+    const char *p = buf.data();
+    uint32_t tlen, blen, rlen;
+    std::memcpy(&r.offset_us, p, 8);
+    std::memcpy(&r.duration_us, p + 8, 4);
+    std::memcpy(&r.status, p + 12, 2);
+    r.method = (uint8_t)p[14];
+    std::memcpy(&tlen, p + 16, 4);
+    std::memcpy(&blen, p + 20, 4);
+    std::memcpy(&rlen, p + 24, 4);
+    if ((uint64_t)28 + tlen + blen + rlen != len)
+        return false;
+    r.target.assign(p + 28, tlen);
+    r.body.assign(p + 28 + tlen, blen);
+    r.response.assign(p + 28 + tlen + blen, rlen);
+    return true;
+}
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--file")
+            o.file = next();
+        else if (a == "--host")
+            o.host = next();
+        else if (a == "--port")
+            o.port = std::stoi(next());
+        else if (a == "--speed")
+            o.speed = std::stod(next());
+        else if (a == "--connections")
+            o.connections = std::max(1, std::stoi(next()));
+        else if (a == "--show")
+            o.show = std::stoi(next());
+        else if (a == "--json")
+            o.json_out = true;
+        else
+        {
+            o.file.clear();
+            break;
+        }
+    }
+    if (o.file.empty())
+    {
+        std::cerr << "usage: replay --file CAPTURE [--host H] [--port P] [--speed X (0 = unpaced)]\n"
+                     "              [--connections N] [--show N] [--json]\n";
+        return false;
+    }
+    return true;
+}
+
+// "/transactions/ACC1234567?limit=5" -> "/transactions/{}"
+std::string route_of(const std::string &target)
+{
+    std::string path = target.substr(0, target.find('?'));
+    std::string out;
+    size_t i = 0;
+    while (i < path.size())
+    {
+        size_t j = path.find('/', i + 1);
+        std::string seg = path.substr(i, j == std::string::npos ? std::string::npos : j - i);
+        bool id = seg.size() > 1 && (std::all_of(seg.begin() + 1, seg.end(), ::isdigit) || seg.compare(1, 3, "ACC") == 0);
+        out += id ? "/{}" : seg;
+        if (j == std::string::npos)
+            break;
+        i = j;
+    }
+    return out.empty() ? "/" : out;
+}
+
+// captured id -> id the replay server assigned
+class IdMap
+{
+public:
+    void learn(const CaptureRecord &rec, const std::string &replayed)
+    {
+        bool create = rec.target.rfind("/create_account", 0) == 0, login = rec.target.rfind("/login", 0) == 0;
+        if (!create && !login)
+            return;
+        json was = json::parse(rec.response, nullptr, false), now = json::parse(replayed, nullptr, false);
+        if (!was.is_object() || !now.is_object())
+            return;
+        std::lock_guard<std::mutex> lk(mu_);
+        if (create && was.contains("account_number") && now.contains("account_number"))
+            accounts_[was["account_number"].get<std::string>()] = now["account_number"].get<std::string>();
+        if (login && was.contains("user_id") && now.contains("user_id"))
+            users_[was["user_id"].get<long long>()] = now["user_id"].get<long long>();
+    }
+
+    std::string target(const std::string &t) const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string out;
+        size_t i = 0;
+        while (i <= t.size())
+        {
+            size_t j = t.find_first_of("/?&=", i);
+            if (j == std::string::npos)
+                j = t.size();
+            out += map_token(t.substr(i, j - i));
+            if (j < t.size())
+                out += t[j];
+            i = j + 1;
+        }
+        return out;
+    }
+
+    std::string body(const std::string &b) const
+    {
+        json j = json::parse(b, nullptr, false);
+        if (!j.is_object())
+            return b;
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto &kv : j.items())
+        {
+            if (kv.value().is_string())
+            {
+                auto it = accounts_.find(kv.value().get<std::string>());
+                if (it != accounts_.end())
+                    kv.value() = it->second;
+            }
+            else if (kv.key() == "user_id" && kv.value().is_number_integer())
+            {
+                auto it = users_.find(kv.value().get<long long>());
+                if (it != users_.end())
+                    kv.value() = it->second;
+            }
+        }
+        return j.dump();
+    }
+
+private:
+    std::string map_token(const std::string &tok) const
+    {
+        auto a = accounts_.find(tok);
+        if (a != accounts_.end())
+            return a->second;
+        if (!tok.empty() && std::all_of(tok.begin(), tok.end(), ::isdigit) && tok.size() < 18)
+        {
+            auto u = users_.find(std::stoll(tok));
+            if (u != users_.end())
+                return std::to_string(u->second);
+        }
+        return tok;
+    }
+
+    mutable std::mutex mu_;
+    std::unordered_map<std::string, std::string> accounts_;
+    std::unordered_map<long long, long long> users_;
+};
+
+std::string outcome(const std::string &body)
+{
+    json j = json::parse(body, nullptr, false);
+    if (!j.is_object())
+        return "";
+    return j.value("status", "") + (j.contains("reason") ? "/" + j["reason"].get<std::string>() : "");
+}
+
+struct RouteStats
+{
+    std::vector<uint64_t> lat_us, orig_us;
+    uint64_t mismatches = 0, errors = 0;
+};
+
+double pct(std::vector<uint64_t> &v, double q)
+{
+    if (v.empty())
+        return 0;
+    size_t k = std::min(v.size() - 1, (size_t)(q * (double)v.size()));
+    std::nth_element(v.begin(), v.begin() + (long)k, v.end());
+    return (double)v[k] / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, o))
+        return 2;
+
+    std::FILE *f = std::fopen(o.file.c_str(), "rb");
+    char magic[8];
+    uint64_t start_us = 0;
+    if (!f || std::fread(magic, 1, 8, f) != 8 || std::memcmp(magic, kCaptureMagic, 8) != 0 || std::fread(&start_us, 8, 1, f) != 1)
+    {
+        std::cerr << "not a capture file: " << o.file << "\n";
+        return 1;
+    }
+    std::vector<CaptureRecord> recs;
+    size_t skipped = 0;
+    for (CaptureRecord r; read_capture_record(f, r);)
+    {
+        if (r.target.rfind("/stream/", 0) == 0)
+            ++skipped;
+        else
+            recs.push_back(std::move(r));
+    }
+    std::fclose(f);
+    if (recs.empty())
+    {
+        std::cerr << "no replayable requests in " << o.file << "\n";
+        return 1;
+    }
+    std::cerr << "replaying " << recs.size() << " requests (" << skipped << " /stream skipped), captured over "
+              << std::fixed << std::setprecision(1) << (double)recs.back().offset_us / 1e6 << " s\n";
+
+    IdMap ids;
+    std::atomic<size_t> next{0};
+    std::mutex stats_mu;
+    std::map<std::string, RouteStats> stats;
+    std::vector<std::string> shown;
+    uint64_t base_us = recs.front().offset_us;
+    auto t0 = Clock::now();
+
+    auto worker = [&]()
+    {
+        httplib::Client cli(o.host, o.port);
+        cli.set_keep_alive(true);
+        cli.set_tcp_nodelay(true);
+        cli.set_read_timeout(30, 0);
+        for (size_t i; (i = next.fetch_add(1)) < recs.size();)
+        {
+            const CaptureRecord &rec = recs[i];
+            Clock::time_point due = t0;
+            if (o.speed > 0)
+            {
+                due += std::chrono::microseconds((uint64_t)((double)(rec.offset_us - base_us) / o.speed));
+                std::this_thread::sleep_until(due);
+            }
+            else
+                due = Clock::now();
+            std::string target = ids.target(rec.target);
+            httplib::Result res = rec.method == 1 ? cli.Post(target, ids.body(rec.body), "application/json")
+                                                  : cli.Get(target);
+            uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+            std::string problem;
+            if (!res)
+                problem = "transport error: " + httplib::to_string(res.error());
+            else
+            {
+                if (rec.method != 0)
+                    ids.learn(rec, res->body);
+                if (res->status != rec.status)
+                    problem = "HTTP " + std::to_string(rec.status) + " -> " + std::to_string(res->status);
+                else if (rec.method != 0 && outcome(rec.response) != outcome(res->body))
+                    problem = "\"" + outcome(rec.response) + "\" -> \"" + outcome(res->body) + "\"";
+            }
+            std::lock_guard<std::mutex> lk(stats_mu);
+            RouteStats &st = stats[(rec.method == 1 ? "POST " : "GET ") + route_of(rec.target)];
+            st.lat_us.push_back(us);
+            st.orig_us.push_back(rec.duration_us);
+            if (!res)
+                ++st.errors;
+            else if (!problem.empty())
+                ++st.mismatches;
+            if (!problem.empty() && (int)shown.size() < o.show)
+                shown.push_back("#" + std::to_string(i) + " " + target + ": " + problem);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int c = 0; c < o.connections; ++c)
+        threads.emplace_back(worker);
+    for (auto &t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    for (const std::string &s : shown)
+        std::cerr << "MISMATCH " << s << "\n";
+    uint64_t total_bad = 0;
+    json out = {{"requests", recs.size()}, {"elapsed_s", elapsed}, {"rps", (double)recs.size() / elapsed}, {"speed", o.speed}, {"connections", o.connections}};
+    out["routes"] = json::array();
+    if (!o.json_out)
+        std::cout << std::left << std::setw(28) << "route" << std::right << std::setw(8) << "count" << std::setw(9) << "mismatch"
+                  << std::setw(8) << "errors" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+                  << std::setw(14) << "orig p50 ms" << std::setw(14) << "orig p99 ms" << "\n";
+    for (auto &kv : stats)
+    {
+        RouteStats &st = kv.second;
+        total_bad += st.mismatches + st.errors;
+        double p50 = pct(st.lat_us, 0.5), p99 = pct(st.lat_us, 0.99), o50 = pct(st.orig_us, 0.5), o99 = pct(st.orig_us, 0.99);
+        out["routes"].push_back({{"route", kv.first}, {"count", st.lat_us.size()}, {"mismatches", st.mismatches}, {"errors", st.errors},
+                                 {"p50_ms", p50}, {"p99_ms", p99}, {"orig_handler_p50_ms", o50}, {"orig_handler_p99_ms", o99}});
+        if (!o.json_out)
+            std::cout << std::left << std::setw(28) << kv.first << std::right << std::setw(8) << st.lat_us.size() << std::setw(9) << st.mismatches
+                      << std::setw(8) << st.errors << std::fixed << std::setprecision(2) << std::setw(10) << p50 << std::setw(10) << p99
+                      << std::setw(14) << o50 << std::setw(14) << o99 << "\n";
+    }
+    out["mismatches"] = total_bad;
+    if (o.json_out)
+        std::cout << out.dump(2) << "\n";
+    else
+        std::cout << recs.size() << " requests in " << std::setprecision(2) << elapsed << " s (" << std::setprecision(1)
+                  << (double)recs.size() / elapsed << " req/s), " << total_bad << " mismatched\n"
+                  << "(orig = handler time recorded at capture; replay latency is client-side from the scheduled start)\n";
+    return total_bad ? 1 : 0;
+}
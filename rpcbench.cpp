@@ -0,0 +1,399 @@
+// rpcbench.cpp - the binary RPC port against HTTP/JSON for the same operation
+// Build: g++ rpcbench.cpp -O2 -std=c++17 -lsqlite3 -lz -pthread -o rpcbench
+//
+// Start the server with MINIBANK_RPC_PORT=9090, then:
+//
+//   ./rpcbench                                       # transfers, both paths
+//   ./rpcbench --op deposit --connections 8 --depth 128
+//   ./rpcbench --mode rpc --duration 30 --json
+//   ./rpcbench --mode pipelined --depth 16      # HTTP/1.1 pipelining
+//
+// Setup creates --accounts funded accounts over HTTP. The HTTP path runs
+// --connections keep-alive clients, each waiting for a reply before sending
+// the next request. The pipelined path sends the same HTTP requests but keeps
+// --depth of them in flight per connection, as the RPC path does with its
+// frames. Reports ops/s and latency per path and the RPC/HTTP throughput
+// ratio; replies that are not "ok" count as errors.
+
+#include "minibank.h"
+
+#include <netdb.h>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string host = "localhost";
+    int port = 8080;
+    int rpc_port = 9090;
+    std::string mode = "both"; // http, pipelined, rpc or both (http and rpc)
+    std::string op = "transfer";
+    int connections = 4;
+    int depth = 64;
+    int accounts = 100;
+    double duration = 10;
+    bool json_out = false;
+};
+
+bool parse_args(int argc, char **argv, Options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string
+        { return i + 1 < argc ? argv[++i] : ""; };
+        if (a == "--host")
+            o.host = next();
+        else if (a == "--port")
+            o.port = std::stoi(next());
+        else if (a == "--rpc-port")
+            o.rpc_port = std::stoi(next());
+        else if (a == "--mode")
+            o.mode = next();
+        else if (a == "--op")
+            o.op = next();
+        else if (a == "--connections")
+            o.connections = std::max(1, std::stoi(next()));
+        else if (a == "--depth")
+            o.depth = std::max(1, std::stoi(next()));
+        else if (a == "--accounts")
+            o.accounts = std::max(2, std::stoi(next()));
+        else if (a == "--duration")
+            o.duration = std::stod(next());
+        else if (a == "--json")
+            o.json_out = true;
+        else
+        {
+            o.op.clear();
+            break;
+        }
+    }
+    if ((o.op != "transfer" && o.op != "deposit" && o.op != "withdraw" && o.op != "balance") ||
+        (o.mode != "http" && o.mode != "pipelined" && o.mode != "rpc" && o.mode != "both"))
+    {
+        std::cerr << "usage: rpcbench [--host H] [--port P] [--rpc-port P] [--mode http|pipelined|rpc|both]\n"
+                     "                [--op transfer|deposit|withdraw|balance] [--connections N] [--depth N]\n"
+                     "                [--accounts N] [--duration S] [--json]\n";
+        return false;
+    }
+    return true;
+}
+
+json post(httplib::Client &cli, const std::string &path, const json &body)
+{
+    auto r = cli.Post(path, body.dump(), "application/json");
+    return r && r->status == 200 ? json::parse(r->body, nullptr, false) : json();
+}
+
+// one user owning `n` accounts with plenty of money
+std::vector<std::string> setup_accounts(const Options &o)
+{
+    httplib::Client cli(o.host, o.port);
+    std::string email = "rpcbench-" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count() % 100000000) + "@bench";
+    post(cli, "/signup", {{"email", email}, {"password", "pw"}});
+    json l = post(cli, "/login", {{"email", email}, {"password", "pw"}});
+    std::vector<std::string> accs;
+    if (!l.is_object() || !l.contains("user_id"))
+        return accs;
+    for (int i = 0; i < o.accounts; ++i)
+    {
+        json a = post(cli, "/create_account", {{"user_id", l["user_id"]}, {"type", "Checking"}});
+        if (!a.is_object() || a.value("status", "") != "ok")
+            continue;
+        accs.push_back(a["account_number"]);
+        post(cli, "/deposit", {{"account_number", accs.back()}, {"amount", 1e9}});
+    }
+    return accs;
+}
+
+struct Result
+{
+    std::vector<uint64_t> lat_us;
+    uint64_t errors = 0;
+};
+
+RpcCall make_call(const Options &o, const std::vector<std::string> &accs, std::mt19937_64 &rng, uint32_t id)
+{
+    std::uniform_int_distribution<size_t> pick(0, accs.size() - 1);
+    RpcCall c;
+    c.id = id;
+    c.op = (uint8_t)(o.op == "deposit" ? RpcOp::Deposit : o.op == "withdraw" ? RpcOp::Withdraw : o.op == "transfer" ? RpcOp::Transfer : RpcOp::Balance);
+    c.account = accs[pick(rng)];
+    if (c.op == (uint8_t)RpcOp::Transfer)
+        do
+            c.to = accs[pick(rng)];
+        while (c.to == c.account);
+    c.amount = 1.0;
+    return c;
+}
+
+void run_http(const Options &o, const std::vector<std::string> &accs, Clock::time_point deadline, int t, Result &res)
+{
+    httplib::Client cli(o.host, o.port);
+    cli.set_keep_alive(true);
+    cli.set_tcp_nodelay(true);
+    std::mt19937_64 rng(1000 + t);
+    while (Clock::now() < deadline)
+    {
+        RpcCall c = make_call(o, accs, rng, 0);
+        auto t0 = Clock::now();
+        httplib::Result r = c.op == (uint8_t)RpcOp::Balance    ? cli.Get("/balance/" + c.account)
+                            : c.op == (uint8_t)RpcOp::Transfer ? cli.Post("/transfer", json{{"from", c.account}, {"to", c.to}, {"amount", c.amount}}.dump(), "application/json")
+                                                               : cli.Post("/" + o.op, json{{"account_number", c.account}, {"amount", c.amount}}.dump(), "application/json");
+        res.lat_us.push_back((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+        if (!r || r->status != 200 || r->body.find("\"status\":\"ok\"") == std::string::npos)
+            ++res.errors;
+    }
+}
+
+int rpc_connect(const Options &o)
+{
+    addrinfo hints{}, *ai = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(o.host.c_str(), std::to_string(o.rpc_port).c_str(), &hints, &ai) != 0)
+        return -1;
+    int fd = -1;
+    for (addrinfo *a = ai; a && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool send_all(int fd, const std::string &out)
+{
+    for (size_t sent = 0; sent < out.size();)
+    {
+        ssize_t w = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (w <= 0)
+            return false;
+        sent += (size_t)w;
+    }
+    return true;
+}
+
+// keeps `depth` requests in flight; replies arrive in request order, so the
+// send times queue up the same way. Stops issuing at the deadline and drains.
+void run_rpc(const Options &o, const std::vector<std::string> &accs, Clock::time_point deadline, int t, Result &res)
+{
+    int fd = rpc_connect(o);
+    if (fd < 0)
+    {
+        res.errors = 1;
+        return;
+    }
+    std::mt19937_64 rng(1000 + t);
+    std::deque<Clock::time_point> sent_at;
+    uint32_t next_id = 1;
+    std::string out, in;
+    for (int i = 0; i < o.depth; ++i)
+    {
+        rpc_put_call(out, make_call(o, accs, rng, next_id++));
+        sent_at.push_back(Clock::now());
+    }
+    char buf[65536];
+    bool ok = send_all(fd, out);
+    while (ok && !sent_at.empty())
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        in.append(buf, (size_t)n);
+        out.clear();
+        auto now = Clock::now();
+        bool more = now < deadline;
+        size_t at = 0, len;
+        while ((len = rpc_frame(in, at)) != 0 && len != SIZE_MAX)
+        {
+            RpcReply r;
+            if (!rpc_take_reply(in.data() + at + 4, len - 4, r) || !r.ok)
+                ++res.errors;
+            res.lat_us.push_back((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - sent_at.front()).count());
+            sent_at.pop_front();
+            at += len;
+            if (more)
+            {
+                rpc_put_call(out, make_call(o, accs, rng, next_id++));
+                sent_at.push_back(now);
+            }
+        }
+        in.erase(0, at);
+        if (!out.empty())
+            ok = send_all(fd, out);
+    }
+    res.errors += sent_at.size();
+    close(fd);
+}
+
+std::string http_request(const Options &o, const RpcCall &c)
+{
+    if (c.op == (uint8_t)RpcOp::Balance)
+        return "GET /balance/" + c.account + " HTTP/1.1\r\nHost: " + o.host + "\r\n\r\n";
+    std::string body = c.op == (uint8_t)RpcOp::Transfer ? json{{"from", c.account}, {"to", c.to}, {"amount", c.amount}}.dump()
+                                                        : json{{"account_number", c.account}, {"amount", c.amount}}.dump();
+    return "POST /" + o.op + " HTTP/1.1\r\nHost: " + o.host + "\r\nContent-Type: application/json\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// bytes in the first complete response of `in` (these routes always send
+// Content-Length), 0 if incomplete
+size_t http_response_length(const std::string &in)
+{
+    size_t hdr_end = in.find("\r\n\r\n");
+    if (hdr_end == std::string::npos)
+        return 0;
+    size_t cl = 0, p = in.find("Content-Length: ");
+    if (p != std::string::npos && p < hdr_end)
+        cl = std::strtoull(in.c_str() + p + 16, nullptr, 10);
+    return in.size() >= hdr_end + 4 + cl ? hdr_end + 4 + cl : 0;
+}
+
+// run_rpc with HTTP/1.1 requests on the API port. The server closes the
+// connection after its keep-alive limit; requests sent behind that response
+// were never run, so they are dropped (not errors) and the connection reopened.
+void run_pipelined(const Options &o, const std::vector<std::string> &accs, Clock::time_point deadline, int t, Result &res)
+{
+    Options http = o;
+    http.rpc_port = o.port;
+    std::mt19937_64 rng(1000 + t);
+    char buf[65536];
+    while (Clock::now() < deadline)
+    {
+        int fd = rpc_connect(http);
+        if (fd < 0)
+        {
+            ++res.errors;
+            return;
+        }
+        std::deque<Clock::time_point> sent_at;
+        std::string out, in;
+        bool closing = false;
+        for (int i = 0; i < o.depth; ++i)
+        {
+            out += http_request(o, make_call(o, accs, rng, 0));
+            sent_at.push_back(Clock::now());
+        }
+        bool ok = send_all(fd, out);
+        while (ok && !closing && !sent_at.empty())
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                break;
+            in.append(buf, (size_t)n);
+            out.clear();
+            auto now = Clock::now();
+            size_t at = 0, len;
+            while (!closing && !sent_at.empty() && (len = http_response_length(in.substr(at))) != 0)
+            {
+                std::string r = in.substr(at, len);
+                if (r.compare(0, 12, "HTTP/1.1 200") != 0 || r.find("\"status\":\"ok\"") == std::string::npos)
+                    ++res.errors;
+                res.lat_us.push_back((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - sent_at.front()).count());
+                sent_at.pop_front();
+                at += len;
+                closing = r.find("Connection: close") != std::string::npos;
+                if (!closing && now < deadline)
+                {
+                    out += http_request(o, make_call(o, accs, rng, 0));
+                    sent_at.push_back(now);
+                }
+            }
+            in.erase(0, at);
+            if (!out.empty())
+                ok = send_all(fd, out);
+        }
+        if (!closing)
+            res.errors += sent_at.size();
+        close(fd);
+    }
+}
+
+json run(const std::string &path, const Options &o, const std::vector<std::string> &accs)
+{
+    std::vector<Result> results(o.connections);
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::microseconds((long long)(o.duration * 1e6));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < o.connections; ++t)
+        threads.emplace_back([&, t]
+                             {
+            if (path == "rpc")
+                run_rpc(o, accs, deadline, t, results[t]);
+            else if (path == "pipelined")
+                run_pipelined(o, accs, deadline, t, results[t]);
+            else
+                run_http(o, accs, deadline, t, results[t]); });
+    for (auto &t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<uint64_t> all;
+    uint64_t errors = 0;
+    for (const Result &r : results)
+    {
+        all.insert(all.end(), r.lat_us.begin(), r.lat_us.end());
+        errors += r.errors;
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&](double q)
+    { return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t)(q * (double)all.size()))] / 1000.0; };
+    return {{"path", path}, {"ops", all.size()}, {"errors", errors}, {"ops_per_s", (double)all.size() / elapsed},
+            {"p50_ms", pct(0.50)}, {"p99_ms", pct(0.99)}, {"p999_ms", pct(0.999)}};
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, o))
+        return 2;
+    std::cerr << "setting up " << o.accounts << " accounts..." << std::endl;
+    std::vector<std::string> accs = setup_accounts(o);
+    if (accs.size() < 2)
+    {
+        std::cerr << "setup failed: is the server running on " << o.host << ":" << o.port << "?\n";
+        return 1;
+    }
+
+    json report = json::array();
+    for (const char *path : {"http", "pipelined", "rpc"})
+        if (o.mode == path || (o.mode == "both" && path[0] != 'p'))
+            report.push_back(run(path, o, accs));
+    double ratio = o.mode == "both" && report[0]["ops_per_s"].get<double>() > 0
+                       ? report[1]["ops_per_s"].get<double>() / report[0]["ops_per_s"].get<double>()
+                       : 0;
+
+    if (o.json_out)
+    {
+        json out = {{"op", o.op}, {"connections", o.connections}, {"depth", o.depth}, {"paths", report}};
+        if (ratio > 0)
+            out["rpc_over_http"] = ratio;
+        std::cout << out.dump(2) << "\n";
+        return 0;
+    }
+    std::cout << o.op << ", " << o.connections << " connections, RPC depth " << o.depth << "\n";
+    std::cout << std::left << std::setw(10) << "path" << std::right << std::setw(10) << "ops" << std::setw(8) << "errors"
+              << std::setw(11) << "ops/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << "\n";
+    for (const json &r : report)
+        std::cout << std::left << std::setw(10) << r["path"].get<std::string>() << std::right << std::setw(10) << r["ops"].get<size_t>()
+                  << std::setw(8) << r["errors"].get<uint64_t>() << std::fixed << std::setprecision(1) << std::setw(11) << r["ops_per_s"].get<double>()
+                  << std::setprecision(2) << std::setw(10) << r["p50_ms"].get<double>() << std::setw(10) << r["p99_ms"].get<double>()
+                  << std::setw(10) << r["p999_ms"].get<double>() << "\n";
+    if (ratio > 0)
+        std::cout << "rpc/http throughput: " << std::setprecision(1) << ratio << "x\n";
+    return 0;
+}
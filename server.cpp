@@ -1,9 +1,18 @@
 // server.cpp (NULL-safe patched)
-// Build: g++ server.cpp -std=c++17 -lsqlite3 -pthread -o server
+// Build: g++ server.cpp -std=c++17 -lsqlite3 -lz -pthread -o server
+//        (add -DMINIBANK_ZSTD -lzstd for zstd response compression)
 
+// httplib's default of 5 overflows under connection bursts (and while a hot
+// restart hands the socket over), costing clients a 1 s SYN retransmit
+#define CPPHTTPLIB_LISTEN_BACKLOG 4096
 #include "httplib.h"
 #include "json.hpp"
+#include "minibank.h"
 #include <sqlite3.h>
+#include <zlib.h>
+#ifdef MINIBANK_ZSTD
+#include <zstd.h>
+#endif
 #include <iostream>
 #include <ctime>
 #include <sstream>
@@ -11,138 +20,4393 @@
 #include <random>
 #include <vector>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
+#include <charconv>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <list>
+#include <cmath>
+#include <fstream>
+#include <cstdarg>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <grp.h>
+#include <sys/wait.h>
+#include <csignal>
 
-using json = nlohmann::json;
+// BEGIN IMMEDIATE on a connection that is rolled back unless committed.
+// Declare it after the lock serializing writers, so that on any early
+// return or exception it is undone while the lock is still held.
+class SqlTxn
+{
+public:
+    explicit SqlTxn(sqlite3 *db) : db_(db), open_(exec_sql(db, "BEGIN IMMEDIATE;") == SQLITE_OK) {}
+    ~SqlTxn() { rollback(); }
+    SqlTxn(const SqlTxn &) = delete;
+    SqlTxn &operator=(const SqlTxn &) = delete;
+
+    bool began() const { return open_; }
+
+    // false if the transaction could not be committed (it is rolled back)
+    bool commit()
+    {
+        if (!open_)
+            return false;
+        open_ = false;
+        if (exec_sql(db_, "COMMIT;") == SQLITE_OK)
+            return true;
+        exec_sql(db_, "ROLLBACK;");
+        return false;
+    }
+
+    void rollback()
+    {
+        if (open_)
+            exec_sql(db_, "ROLLBACK;");
+        open_ = false;
+    }
+
+private:
+    sqlite3 *db_;
+    bool open_;
+};
+
+// SAVEPOINT inside an open transaction, rolled back to unless released, so
+// a multi-statement write that fails midway leaves nothing behind
+class SqlSavepoint
+{
+public:
+    explicit SqlSavepoint(sqlite3 *db) : db_(db), open_(exec_sql(db, "SAVEPOINT minibank_write;") == SQLITE_OK) {}
+    ~SqlSavepoint()
+    {
+        if (!open_)
+            return;
+        exec_sql(db_, "ROLLBACK TO minibank_write;");
+        exec_sql(db_, "RELEASE minibank_write;");
+    }
+    SqlSavepoint(const SqlSavepoint &) = delete;
+    SqlSavepoint &operator=(const SqlSavepoint &) = delete;
+
+    bool began() const { return open_; }
+
+    void release()
+    {
+        if (open_)
+            exec_sql(db_, "RELEASE minibank_write;");
+        open_ = false;
+    }
+
+private:
+    sqlite3 *db_;
+    bool open_;
+};
+
+// integer setting from the environment, e.g. MINIBANK_ACCOUNT_CACHE_MB=64
+static long env_long(const char *name, long def)
+{
+    const char *v = std::getenv(name);
+    return (v && *v) ? std::atol(v) : def;
+}
+
+// --- request tracing
+// Each request gets a TraceRecord of named phase timings, collected by the
+// TraceSpans in minibank.h on the handling thread. Finished records go to a
+// small per-thread ring for /debug/traces, and a sampled subset is written
+// as JSON lines by a background thread.
+class Tracer
+{
+public:
+    static constexpr size_t kRing = 256;
+
+    // path empty = no export; sample_every N exports one request in N
+    Tracer(const std::string &path, long sample_every) : sample_every_(sample_every > 0 ? (uint64_t)sample_every : 0)
+    {
+        if (!path.empty() && sample_every_)
+        {
+            file_.open(path, std::ios::app);
+            if (file_)
+                writer_ = std::thread([this]
+                                      { write_loop(); });
+        }
+    }
+
+    ~Tracer()
+    {
+        {
+            std::lock_guard<std::mutex> lk(export_mu_);
+            stop_ = true;
+        }
+        export_cv_.notify_one();
+        if (writer_.joinable())
+            writer_.join();
+    }
+
+    // starts a record on this thread and returns its request id
+    uint64_t begin(const std::string &route)
+    {
+        Ring &r = local();
+        r.current = TraceRecord();
+        r.current.id = next_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+        r.current.route = route;
+        r.current.started = now_iso();
+        r.t0 = std::chrono::steady_clock::now();
+        t_trace = &r.current;
+        return r.current.id;
+    }
+
+    void end()
+    {
+        Ring &r = local();
+        if (t_trace != &r.current)
+            return;
+        t_trace = nullptr;
+        r.current.total_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - r.t0).count();
+        {
+            std::lock_guard<std::mutex> lk(r.mu);
+            r.done[r.next++ % kRing] = r.current;
+        }
+        if (writer_.joinable() && r.current.id % sample_every_ == 0)
+        {
+            std::lock_guard<std::mutex> lk(export_mu_);
+            if (pending_.size() < 4096)
+                pending_.push_back(r.current.to_json().dump());
+            export_cv_.notify_one();
+        }
+    }
+
+    // the slowest recent requests across all threads
+    json slowest(size_t limit) const
+    {
+        std::vector<TraceRecord> all;
+        {
+            std::lock_guard<std::mutex> lk(rings_mu_);
+            for (const Ring *r : rings_)
+            {
+                std::lock_guard<std::mutex> g(r->mu);
+                size_t n = std::min<size_t>(r->next, kRing);
+                all.insert(all.end(), r->done, r->done + n);
+            }
+        }
+        std::sort(all.begin(), all.end(), [](const TraceRecord &a, const TraceRecord &b)
+                  { return a.total_us > b.total_us; });
+        json arr = json::array();
+        for (size_t i = 0; i < all.size() && i < limit; ++i)
+            arr.push_back(all[i].to_json());
+        return arr;
+    }
+
+private:
+    struct Ring
+    {
+        TraceRecord current;
+        std::chrono::steady_clock::time_point t0;
+        TraceRecord done[kRing];
+        size_t next = 0;
+        mutable std::mutex mu;
+    };
+
+    // a ring lives as long as the process; when its thread exits it goes to
+    // the next new thread with its finished records, as Metrics does with
+    // slabs, so worker pool churn does not keep adding rings
+    Ring &local()
+    {
+        struct Owner
+        {
+            Ring *ring = nullptr;
+            ~Owner()
+            {
+                if (!ring)
+                    return;
+                std::lock_guard<std::mutex> lk(free_mu_);
+                free_.push_back(ring);
+            }
+        };
+        thread_local Owner own;
+        if (!own.ring)
+        {
+            {
+                std::lock_guard<std::mutex> lk(free_mu_);
+                if (!free_.empty())
+                {
+                    own.ring = free_.back();
+                    free_.pop_back();
+                    return *own.ring;
+                }
+            }
+            own.ring = new Ring();
+            std::lock_guard<std::mutex> lk(rings_mu_);
+            rings_.push_back(own.ring);
+        }
+        return *own.ring;
+    }
+
+    void write_loop()
+    {
+        std::unique_lock<std::mutex> lk(export_mu_);
+        while (true)
+        {
+            export_cv_.wait(lk, [this]
+                            { return stop_ || !pending_.empty(); });
+            std::deque<std::string> batch;
+            batch.swap(pending_);
+            lk.unlock();
+            for (const std::string &line : batch)
+                file_ << line << "\n";
+            file_.flush();
+            lk.lock();
+            if (stop_ && pending_.empty())
+                return;
+        }
+    }
+
+    uint64_t sample_every_;
+    std::atomic<uint64_t> next_id_{0};
+    std::vector<Ring *> rings_;
+    mutable std::mutex rings_mu_;
+    // static: exiting threads may outlive main()'s Tracer
+    static inline std::mutex free_mu_;
+    static inline std::vector<Ring *> free_;
+    std::ofstream file_;
+    std::thread writer_;
+    std::deque<std::string> pending_;
+    bool stop_ = false;
+    std::mutex export_mu_;
+    std::condition_variable export_cv_;
+};
+
+// --- content negotiation
+// timed() picks the response's wire encoding (minibank.h) from Accept and
+// its Content-Encoding from Accept-Encoding, recording both for the
+// handler's thread in t_wire and t_coding.
+static Wire accepted_wire(const httplib::Request &req)
+{
+    std::istringstream ss(req.get_header_value("Accept"));
+    Wire w;
+    for (std::string tok; std::getline(ss, tok, ',');)
+    {
+        size_t q = tok.find("q=");
+        if (q != std::string::npos && std::atof(tok.c_str() + q + 2) <= 0)
+            continue;
+        if (wire_of(tok, w))
+            return w;
+    }
+    return Wire::Json;
+}
+
+static Coding accepted_coding(const httplib::Request &req)
+{
+    std::istringstream ss(req.get_header_value("Accept-Encoding"));
+    bool gzip = false, deflate = false, zstd = false;
+    for (std::string tok; std::getline(ss, tok, ',');)
+    {
+        size_t q = tok.find("q=");
+        if (q != std::string::npos && std::atof(tok.c_str() + q + 2) <= 0)
+            continue;
+        tok = tok.substr(0, tok.find(';'));
+        tok.erase(std::remove_if(tok.begin(), tok.end(), ::isspace), tok.end());
+        std::transform(tok.begin(), tok.end(), tok.begin(), ::tolower);
+        gzip |= tok == "gzip" || tok == "x-gzip" || tok == "*";
+        deflate |= tok == "deflate";
+        zstd |= tok == "zstd";
+    }
+#ifdef MINIBANK_ZSTD
+    if (zstd)
+        return Coding::Zstd;
+#else
+    (void)zstd;
+#endif
+    return gzip ? Coding::Gzip : deflate ? Coding::Deflate : Coding::Identity;
+}
+
+// the same representation in another encoding is a different entity. The
+// coding suffix follows what was negotiated, not whether this particular
+// body crossed the compression threshold, so a 304 names the same tag
+static std::string wire_etag(const std::string &etag)
+{
+    static const char *wire_suffix[] = {"", "-mp", "-cb"}, *coding_suffix[] = {"", "-gz", "-df", "-zs"};
+    if ((t_wire == Wire::Json && t_coding == Coding::Identity) || etag.size() < 2)
+        return etag;
+    return etag.substr(0, etag.size() - 1) + wire_suffix[(int)t_wire] + coding_suffix[(int)t_coding] + "\"";
+}
+
+static std::unique_lock<std::mutex> lock_traced(std::mutex &m)
+{
+    TraceSpan sp("lock");
+    return std::unique_lock<std::mutex>(m);
+}
+
+// --- traffic capture
+// Optional log of every routed request for replay.cpp, in the file format
+// described with CaptureRecord in minibank.h. Records are encoded on the
+// request thread into a shared buffer (one short lock, no I/O) and a writer
+// thread appends the buffer to the file every 50 ms. If the writer falls
+// behind by more than kMaxBuffer bytes, records are dropped and counted
+// rather than stalling requests. Request bodies include passwords, so the
+// file is created 0600.
+class Capture
+{
+public:
+    static constexpr size_t kMaxBuffer = 64 << 20;
+
+    // path empty = capture off
+    explicit Capture(const std::string &path)
+    {
+        if (path.empty())
+            return;
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || !(file_ = fdopen(fd, "wb")))
+        {
+            std::cerr << "[CAPTURE] cannot open " << path << "\n";
+            if (fd >= 0)
+                ::close(fd);
+            return;
+        }
+        t0_ = std::chrono::steady_clock::now();
+        uint64_t start_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        std::fwrite(kCaptureMagic, 1, 8, file_);
+        std::fwrite(&start_us, 8, 1, file_);
+        writer_ = std::thread([this]
+                              { write_loop(); });
+    }
+
+    ~Capture()
+    {
+        if (!file_)
+            return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+        std::fclose(file_);
+    }
+
+    bool enabled() const { return file_ != nullptr; }
+    uint64_t records() const { return records_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    void record(const httplib::Request &req, const httplib::Response &res, std::chrono::steady_clock::time_point started)
+    {
+        if (!file_)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        uint64_t offset = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(started - t0_).count();
+        uint32_t dur = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+        // handlers that only set content leave status at -1; httplib sends 200
+        uint16_t status = (uint16_t)(res.status == -1 ? 200 : res.status);
+        uint8_t method = req.method == "GET" ? 0 : req.method == "POST" ? 1 : 2;
+        uint32_t tlen = (uint32_t)req.target.size(), blen = (uint32_t)req.body.size(), rlen = method == 0 ? 0 : (uint32_t)res.body.size();
+        uint32_t len = 28 + tlen + blen + rlen;
+        char head[32] = {};
+        std::memcpy(head, &len, 4);
+        std::memcpy(head + 4, &offset, 8);
+        std::memcpy(head + 12, &dur, 4);
+        std::memcpy(head + 16, &status, 2);
+        head[18] = (char)method;
+        std::memcpy(head + 20, &tlen, 4);
+        std::memcpy(head + 24, &blen, 4);
+        std::memcpy(head + 28, &rlen, 4);
+
+        std::lock_guard<std::mutex> lk(mu_);
+        if (buf_.size() + 4 + len > kMaxBuffer)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buf_.append(head, 32);
+        buf_.append(req.target);
+        buf_.append(req.body);
+        if (rlen)
+            buf_.append(res.body);
+        records_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    void write_loop()
+    {
+        std::string out;
+        std::unique_lock<std::mutex> lk(mu_);
+        while (true)
+        {
+            cv_.wait_for(lk, std::chrono::milliseconds(50), [this]
+                         { return stop_; });
+            out.clear();
+            out.swap(buf_);
+            bool stop = stop_;
+            lk.unlock();
+            if (!out.empty())
+            {
+                std::fwrite(out.data(), 1, out.size(), file_);
+                std::fflush(file_);
+            }
+            lk.lock();
+            if (stop && buf_.empty())
+                return;
+        }
+    }
+
+    std::FILE *file_ = nullptr;
+    std::chrono::steady_clock::time_point t0_;
+    std::thread writer_;
+    std::string buf_;
+    bool stop_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::atomic<uint64_t> records_{0}, dropped_{0};
+};
+
+// --- audit log
+// Handlers append fixed-size records to a bounded lock-free MPSC ring
+// (Vyukov's sequence-numbered cells) and return; a background thread drains
+// it into audit_logs with one prepared INSERT per batch transaction. Batches
+// go through the server's connection under the ledger lock: a second writer
+// connection would invalidate the read snapshots other threads hold on the
+// shared connection and make BEGIN IMMEDIATE fail. When the ring is full
+// the policy either drops the record (counted) or makes the producer wait.
+// In durable mode, regulated actions also wait until the batch holding
+// their record has committed.
+class AuditLog
+{
+public:
+    enum class Policy
+    {
+        Drop,
+        Block
+    };
+
+    AuditLog(sqlite3 *db, std::mutex &write_mu, size_t capacity, Policy policy, bool durable)
+        : db_(db), write_mu_(write_mu), policy_(policy), durable_(durable)
+    {
+        size_t cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        flusher_ = std::thread([this]
+                               { flush_loop(); });
+    }
+
+    ~AuditLog() { close(); }
+
+    // writes out everything queued and stops the flusher
+    void close()
+    {
+        if (!flusher_.joinable())
+            return;
+        stop_.store(true);
+        wake_.notify_one();
+        flusher_.join();
+    }
+
+    // printf-style details, truncated to fit the record; returns false if
+    // the record was dropped, or (durable, regulated) its batch could not be
+    // written
+    bool log(long long user_id, const char *action, bool regulated, const char *fmt, ...)
+    {
+        Record r;
+        r.user_id = user_id;
+        r.action = action;
+        r.at = std::time(nullptr);
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(r.details, sizeof(r.details), fmt, ap);
+        va_end(ap);
+
+        size_t pos;
+        while (!try_push(r, pos))
+        {
+            if (policy_ == Policy::Drop)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            wake_.notify_one();
+            std::this_thread::yield();
+        }
+        if (regulated && durable_)
+        {
+            wake_.notify_one();
+            std::unique_lock<std::mutex> lk(durable_mu_);
+            durable_cv_.wait(lk, [&]
+                             { return committed_.load() > pos; });
+            for (const auto &f : failed_)
+                if (pos >= f.first && pos < f.second)
+                    return false;
+        }
+        return true;
+    }
+
+    size_t depth() const { return enqueue_pos_.load(std::memory_order_relaxed) - committed_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+    uint64_t batches() const { return batches_.load(std::memory_order_relaxed); }
+
+private:
+    struct Record
+    {
+        long long user_id;
+        const char *action; // string literal
+        std::time_t at;
+        char details[112];
+    };
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        Record rec;
+    };
+
+    bool try_push(const Record &r, size_t &out_pos)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell *c;
+        for (;;)
+        {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false; // full
+            else
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+        c->rec = r;
+        c->seq.store(pos + 1, std::memory_order_release);
+        out_pos = pos;
+        return true;
+    }
+
+    // single consumer
+    bool try_pop(Record &r)
+    {
+        Cell &c = cells_[dequeue_pos_ & mask_];
+        if (c.seq.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+            return false;
+        r = c.rec;
+        c.seq.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    void flush_loop()
+    {
+        sqlite3_stmt *ins = nullptr;
+        sqlite3_prepare_v2(db_, "INSERT INTO audit_logs (user_id, action, details, created_at) VALUES (?, ?, ?, ?)", -1, &ins, nullptr);
+        std::vector<Record> batch;
+        batch.reserve(kBatch);
+        while (true)
+        {
+            Record r;
+            size_t first = dequeue_pos_;
+            while (batch.size() < kBatch && try_pop(r))
+                batch.push_back(r);
+            if (batch.empty())
+            {
+                if (stop_.load())
+                    break;
+                std::unique_lock<std::mutex> lk(wake_mu_);
+                wake_.wait_for(lk, std::chrono::milliseconds(10));
+                continue;
+            }
+            bool ok = write_batch(ins, batch);
+            batch.clear();
+            {
+                std::lock_guard<std::mutex> lk(durable_mu_);
+                // durable waiters wake right after this, so only the most
+                // recent failures need remembering
+                if (!ok)
+                    failed_.emplace_back(first, dequeue_pos_);
+                if (failed_.size() > kFailedKept)
+                    failed_.pop_front();
+                committed_.store(dequeue_pos_);
+            }
+            durable_cv_.notify_all();
+        }
+        sqlite3_finalize(ins);
+    }
+
+    // false if the batch was dropped
+    bool write_batch(sqlite3_stmt *ins, const std::vector<Record> &batch)
+    {
+        for (int attempt = 0; attempt < 5; ++attempt)
+        {
+            std::unique_lock<std::mutex> lk(write_mu_);
+            if (exec_sql(db_, "BEGIN IMMEDIATE;") != SQLITE_OK)
+            {
+                lk.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10 << attempt));
+                continue;
+            }
+            bool ok = true;
+            for (const Record &r : batch)
+            {
+                char ts[32];
+                std::tm tm{};
+                localtime_r(&r.at, &tm);
+                std::strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+                if (r.user_id)
+                    sqlite3_bind_int64(ins, 1, r.user_id);
+                else
+                    sqlite3_bind_null(ins, 1);
+                sqlite3_bind_text(ins, 2, r.action, -1, SQLITE_STATIC);
+                sqlite3_bind_text(ins, 3, r.details, -1, SQLITE_STATIC);
+                sqlite3_bind_text(ins, 4, ts, -1, SQLITE_TRANSIENT);
+                ok = sqlite3_step(ins) == SQLITE_DONE && ok;
+                sqlite3_reset(ins);
+            }
+            if (ok && exec_sql(db_, "COMMIT;") == SQLITE_OK)
+            {
+                written_.fetch_add(batch.size(), std::memory_order_relaxed);
+                batches_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            exec_sql(db_, "ROLLBACK;");
+        }
+        std::cerr << "[AUDIT] dropping batch of " << batch.size() << " records after repeated failures" << std::endl;
+        dropped_.fetch_add(batch.size(), std::memory_order_relaxed);
+        return false;
+    }
+
+    static constexpr size_t kBatch = 4096;
+    static constexpr size_t kFailedKept = 64;
+
+    sqlite3 *db_;
+    std::mutex &write_mu_;
+    Policy policy_;
+    bool durable_;
+    size_t mask_ = 0;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) size_t dequeue_pos_ = 0;
+    alignas(64) std::atomic<size_t> committed_{0}; // positions below are written or failed
+    std::deque<std::pair<size_t, size_t>> failed_;    // [first, end) of dropped batches, under durable_mu_
+    std::atomic<uint64_t> dropped_{0}, written_{0}, batches_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex wake_mu_, durable_mu_;
+    std::condition_variable wake_, durable_cv_;
+    std::thread flusher_;
+};
+
+// --- metrics
+// Counters and histogram buckets are slots in per-thread slabs of relaxed
+// atomics: a thread only ever writes its own slab, and a scrape sums every
+// slab, so recording never contends. Histograms are HDR-style log-linear
+// over microseconds (four sub-buckets per power of two). Register every
+// metric before the server starts; there is one Metrics per process.
+class Metrics
+{
+public:
+    static constexpr size_t kSlots = 16384;
+    static constexpr size_t kBuckets = 140; // up to 2^36 us
+
+    // bucket index for a value in microseconds
+    static size_t bucket(uint64_t us)
+    {
+        if (us < 4)
+            return (size_t)us;
+        int e = 63 - __builtin_clzll(us);
+        size_t idx = 4 + (size_t)(e - 2) * 4 + (size_t)((us >> (e - 2)) & 3);
+        return std::min(idx, kBuckets - 1);
+    }
+
+    // largest value (us) that lands in bucket idx
+    static uint64_t bucket_upper(size_t idx)
+    {
+        if (idx < 4)
+            return idx;
+        size_t e = (idx - 4) / 4 + 2, sub = (idx - 4) % 4;
+        return ((5 + sub) << (e - 2)) - 1;
+    }
+
+    // q-quantile (0..1) from a bucket array, as the bucket's upper bound
+    static uint64_t quantile(const std::vector<uint64_t> &buckets, double q)
+    {
+        uint64_t total = 0;
+        for (uint64_t c : buckets)
+            total += c;
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (double)(total - 1)) + 1, seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i)
+            if ((seen += buckets[i]) >= rank)
+                return bucket_upper(i);
+        return bucket_upper(buckets.size() - 1);
+    }
+
+    size_t counter(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        return define(name, help, labels, Def::Counter, 1);
+    }
+
+    size_t histogram(const std::string &name, const std::string &help, const std::string &labels = "")
+    {
+        // buckets, then sum (us), then count
+        return define(name, help, labels, Def::Histogram, kBuckets + 2);
+    }
+
+    // sampled at scrape time (queue depths, cache sizes, external counters)
+    void gauge(const std::string &name, const std::string &help, std::function<double()> fn, bool monotonic = false)
+    {
+        Def d;
+        d.name = name;
+        d.help = help;
+        d.kind = monotonic ? Def::CounterFn : Def::Gauge;
+        d.fn = std::move(fn);
+        defs_.push_back(std::move(d));
+    }
+
+    void inc(size_t slot, uint64_t v = 1)
+    {
+        local().v[slot].fetch_add(v, std::memory_order_relaxed);
+    }
+
+    void observe_us(size_t hist, uint64_t us)
+    {
+        Slab &s = local();
+        s.v[hist + bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        s.v[hist + kBuckets].fetch_add(us, std::memory_order_relaxed);
+        s.v[hist + kBuckets + 1].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <class Clock>
+    void observe_since(size_t hist, typename Clock::time_point t0)
+    {
+        observe_us(hist, (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+    }
+
+    uint64_t read(size_t slot) const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        uint64_t t = 0;
+        for (const Slab *s : slabs_)
+            t += s->v[slot].load(std::memory_order_relaxed);
+        return t;
+    }
+
+    std::vector<uint64_t> read_buckets(size_t hist) const
+    {
+        std::vector<uint64_t> b(kBuckets, 0);
+        std::lock_guard<std::mutex> lk(mu_);
+        for (const Slab *s : slabs_)
+            for (size_t i = 0; i < kBuckets; ++i)
+                b[i] += s->v[hist + i].load(std::memory_order_relaxed);
+        return b;
+    }
+
+    // Prometheus text exposition format
+    std::string render() const
+    {
+        std::map<std::string, std::vector<const Def *>> by_name;
+        for (const Def &d : defs_)
+            by_name[d.name].push_back(&d);
+        std::ostringstream o;
+        o << std::setprecision(12);
+        for (const auto &kv : by_name)
+        {
+            const Def &first = *kv.second.front();
+            static const char *types[] = {"counter", "histogram", "gauge", "counter"};
+            o << "# HELP " << kv.first << " " << first.help << "\n";
+            o << "# TYPE " << kv.first << " " << types[first.kind] << "\n";
+            for (const Def *d : kv.second)
+            {
+                std::string lb = d->labels.empty() ? "" : "{" + d->labels + "}";
+                if (d->kind == Def::Gauge || d->kind == Def::CounterFn)
+                    o << d->name << lb << " " << d->fn() << "\n";
+                else if (d->kind == Def::Counter)
+                    o << d->name << lb << " " << read(d->slot) << "\n";
+                else
+                {
+                    // expose power-of-two bucket edges; the internal
+                    // sub-buckets only matter for quantiles
+                    std::vector<uint64_t> b = read_buckets(d->slot);
+                    std::string sep = d->labels.empty() ? "" : d->labels + ",";
+                    uint64_t cum = 0;
+                    for (size_t i = 0; i < kBuckets; ++i)
+                    {
+                        cum += b[i];
+                        bool edge = i < 2 || (i >= 3 && (i - 3) % 4 == 0);
+                        if (!edge)
+                            continue;
+                        o << d->name << "_bucket{" << sep << "le=\"" << (double)(bucket_upper(i) + 1) / 1e6 << "\"} " << cum << "\n";
+                    }
+                    o << d->name << "_bucket{" << sep << "le=\"+Inf\"} " << cum << "\n";
+                    o << d->name << "_sum" << lb << " " << (double)read(d->slot + kBuckets) / 1e6 << "\n";
+                    o << d->name << "_count" << lb << " " << read(d->slot + kBuckets + 1) << "\n";
+                }
+            }
+        }
+        return o.str();
+    }
+
+private:
+    struct Def
+    {
+        enum Kind
+        {
+            Counter,
+            Histogram,
+            Gauge,
+            CounterFn
+        };
+        std::string name, help, labels;
+        Kind kind = Counter;
+        size_t slot = 0;
+        std::function<double()> fn;
+    };
+
+    struct Slab
+    {
+        std::atomic<uint64_t> v[kSlots];
+    };
+
+    size_t define(const std::string &name, const std::string &help, const std::string &labels, Def::Kind kind, size_t width)
+    {
+        if (next_slot_ + width > kSlots)
+            throw std::runtime_error("metrics: out of slots");
+        Def d;
+        d.name = name;
+        d.help = help;
+        d.labels = labels;
+        d.kind = kind;
+        d.slot = next_slot_;
+        next_slot_ += width;
+        defs_.push_back(d);
+        return d.slot;
+    }
+
+    // a slab lives as long as the process; when its thread exits it goes to
+    // the next new thread, counts and all, so a worker pool that grows and
+    // shrinks does not add a slab for every thread it ever started
+    Slab &local()
+    {
+        struct Owner
+        {
+            Slab *slab = nullptr;
+            ~Owner()
+            {
+                if (!slab)
+                    return;
+                std::lock_guard<std::mutex> lk(free_mu_);
+                free_.push_back(slab);
+            }
+        };
+        thread_local Owner own;
+        if (!own.slab)
+        {
+            {
+                std::lock_guard<std::mutex> lk(free_mu_);
+                if (!free_.empty())
+                {
+                    own.slab = free_.back();
+                    free_.pop_back();
+                    return *own.slab;
+                }
+            }
+            own.slab = new Slab();
+            for (auto &a : own.slab->v)
+                a.store(0, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lk(mu_);
+            slabs_.push_back(own.slab);
+        }
+        return *own.slab;
+    }
+
+    std::vector<Def> defs_;
+    size_t next_slot_ = 0;
+    std::vector<Slab *> slabs_;
+    mutable std::mutex mu_;
+    // static: exiting threads may outlive main()'s Metrics
+    static inline std::mutex free_mu_;
+    static inline std::vector<Slab *> free_;
+};
+
+// --- response compression
+// Applied by timed() after the handler: bodies of at least min_bytes in a
+// text or JSON-like type are encoded with the negotiated coding, chunked
+// responses (/stream) are wrapped so every write goes out as its own flushed
+// block. Responses with an ETag are the ones clients re-fetch unchanged, so
+// their compressed form is kept per target and reused while the identity
+// body hashes the same. Ratio and the thread CPU time spent are exported.
+class Compression
+{
+public:
+    Compression(Metrics &m, bool enabled, size_t min_bytes, int level, size_t cache_bytes)
+        : metrics_(m), enabled_(enabled), min_(min_bytes), level_(level), cache_max_(cache_bytes)
+    {
+        for (Coding c : Compressor::kCodings)
+        {
+            std::string lb = std::string("coding=\"") + coding_name(c) + "\"";
+            Slots &s = slots_[(int)c];
+            s.in = m.counter("minibank_compression_input_bytes_total", "Response bytes before compression.", lb);
+            s.out = m.counter("minibank_compression_output_bytes_total", "Response bytes after compression.", lb);
+            s.cpu = m.histogram("minibank_compression_cpu_seconds", "Thread CPU time spent compressing one body or stream write.", lb);
+        }
+        small_ = m.counter("minibank_compression_skipped_total", "Compressible responses sent as is.", "reason=\"small\"");
+        incompressible_ = m.counter("minibank_compression_skipped_total", "Compressible responses sent as is.", "reason=\"incompressible\"");
+        cache_hits_ = m.counter("minibank_compression_cache_hits_total", "Bodies served from the compressed reply cache.");
+        m.gauge("minibank_compression_ratio", "Compressed bytes over uncompressed bytes, all codings.", [this]
+                {
+            uint64_t in = 0, out = 0;
+            for (Coding c : Compressor::kCodings)
+            {
+                in += metrics_.read(slots_[(int)c].in);
+                out += metrics_.read(slots_[(int)c].out);
+            }
+            return in ? (double)out / (double)in : 1.0; });
+        m.gauge("minibank_compression_cache_bytes", "Compressed bodies held for reuse.", [this]
+                {
+            std::lock_guard<std::mutex> lk(mu_);
+            return (double)cache_bytes_; });
+    }
+
+    Coding negotiate(const httplib::Request &req) const
+    {
+        // a byte range of the identity body cannot be served from a coded one
+        if (!enabled_ || req.has_header("Range"))
+            return Coding::Identity;
+        return accepted_coding(req);
+    }
+
+    void apply(const httplib::Request &req, httplib::Response &res, Coding c)
+    {
+        if (!compressible(res.get_header_value("Content-Type")) || res.has_header("Content-Encoding"))
+            return;
+        if (enabled_)
+            vary(res);
+        if (c == Coding::Identity)
+            return;
+        if (res.content_provider_)
+        {
+            if (res.is_chunked_content_provider_)
+                wrap(res, c);
+            return;
+        }
+        if (res.body.size() < min_)
+        {
+            metrics_.inc(small_);
+            return;
+        }
+        TraceSpan sp("compress");
+        std::string key;
+        size_t hash = 0;
+        if (res.has_header("ETag") && cache_max_)
+        {
+            key = req.target + '\n' + res.get_header_value("Content-Type") + '\n' + coding_name(c);
+            hash = std::hash<std::string>()(res.body);
+            if (cached(key, hash, res.body.size(), res.body))
+            {
+                metrics_.inc(cache_hits_);
+                res.set_header("Content-Encoding", coding_name(c));
+                return;
+            }
+        }
+        std::string out;
+        out.reserve(res.body.size() / 2);
+        Compressor &z = local(c);
+        z.reset();
+        uint64_t t0 = cpu_us();
+        bool ok = z.compress(res.body.data(), res.body.size(), true, out);
+        account(c, res.body.size(), out.size(), cpu_us() - t0);
+        if (!ok || out.size() >= res.body.size())
+        {
+            metrics_.inc(incompressible_);
+            return;
+        }
+        if (!key.empty())
+            remember(key, hash, res.body.size(), out);
+        res.body.swap(out);
+        res.set_header("Content-Encoding", coding_name(c));
+    }
+
+private:
+    struct Slots
+    {
+        size_t in = 0, out = 0, cpu = 0;
+    };
+
+    struct Entry
+    {
+        size_t hash = 0, len = 0;
+        std::string body;
+    };
+
+    static bool compressible(const std::string &type)
+    {
+        return type.compare(0, 5, "text/") == 0 || type.compare(0, 16, "application/json") == 0 ||
+               type.compare(0, 19, "application/msgpack") == 0 || type.compare(0, 16, "application/cbor") == 0;
+    }
+
+    static uint64_t cpu_us()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    }
+
+    static void vary(httplib::Response &res)
+    {
+        auto it = res.headers.find("Vary");
+        if (it == res.headers.end())
+            res.set_header("Vary", "Accept-Encoding");
+        else if (it->second.find("Accept-Encoding") == std::string::npos)
+            it->second += ", Accept-Encoding";
+    }
+
+    Compressor &local(Coding c)
+    {
+        thread_local std::unique_ptr<Compressor> per_coding[4];
+        std::unique_ptr<Compressor> &z = per_coding[(int)c];
+        if (!z)
+            z.reset(new Compressor(c, level_));
+        return *z;
+    }
+
+    void account(Coding c, size_t in, size_t out, uint64_t cpu)
+    {
+        const Slots &s = slots_[(int)c];
+        metrics_.inc(s.in, in);
+        metrics_.inc(s.out, out);
+        metrics_.observe_us(s.cpu, cpu);
+    }
+
+    // every write of the inner provider becomes one flushed compressed block
+    void wrap(httplib::Response &res, Coding c)
+    {
+        struct Stream
+        {
+            Compressor z;
+            size_t offset = 0; // uncompressed bytes, which is what the inner provider counts
+            Stream(Coding c, int level) : z(c, level) {}
+        };
+        auto st = std::make_shared<Stream>(c, level_);
+        httplib::ContentProvider inner = std::move(res.content_provider_);
+        res.content_provider_ = [this, st, inner, c](size_t, size_t length, httplib::DataSink &sink)
+        {
+            auto emit = [&](const char *data, size_t n, bool last)
+            {
+                std::string out;
+                uint64_t t0 = cpu_us();
+                bool ok = st->z.compress(data, n, last, out);
+                account(c, n, out.size(), cpu_us() - t0);
+                st->offset += n;
+                return ok && (out.empty() || sink.write(out.data(), out.size()));
+            };
+            httplib::DataSink tap;
+            tap.write = [&](const char *data, size_t n) { return emit(data, n, false); };
+            tap.is_writable = sink.is_writable;
+            tap.done = [&]
+            {
+                emit(nullptr, 0, true);
+                sink.done();
+            };
+            tap.done_with_trailer = [&](const httplib::Headers &trailer)
+            {
+                emit(nullptr, 0, true);
+                sink.done_with_trailer(trailer);
+            };
+            return inner(st->offset, length, tap);
+        };
+        res.set_header("Content-Encoding", coding_name(c));
+    }
+
+    bool cached(const std::string &key, size_t hash, size_t len, std::string &body)
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = cache_.find(key);
+        if (it == cache_.end() || it->second.hash != hash || it->second.len != len)
+            return false;
+        body = it->second.body;
+        return true;
+    }
+
+    // insertion order eviction; a refreshed entry keeps its place
+    void remember(const std::string &key, size_t hash, size_t len, const std::string &body)
+    {
+        if (body.size() > cache_max_)
+            return;
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = cache_.find(key);
+        if (it == cache_.end())
+        {
+            it = cache_.emplace(key, Entry()).first;
+            order_.push_back(key);
+        }
+        cache_bytes_ += body.size();
+        cache_bytes_ -= it->second.body.size();
+        it->second = Entry{hash, len, body};
+        while (cache_bytes_ > cache_max_ && !order_.empty())
+        {
+            auto old = cache_.find(order_.front());
+            cache_bytes_ -= old->second.body.size();
+            cache_.erase(old);
+            order_.pop_front();
+        }
+    }
+
+    Metrics &metrics_;
+    bool enabled_;
+    size_t min_;
+    int level_;
+    size_t cache_max_;
+    Slots slots_[4];
+    size_t small_ = 0, incompressible_ = 0, cache_hits_ = 0;
+    std::unordered_map<std::string, Entry> cache_;
+    std::deque<std::string> order_;
+    size_t cache_bytes_ = 0;
+    mutable std::mutex mu_;
+};
+
+// --- per-statement SQL statistics and slow query log
+// Keyed by the statement's SQL text (placeholders, not values). Statements
+// slower than the threshold are handed to a background thread that logs
+// them with string literals redacted and the EXPLAIN QUERY PLAN from its own
+// read-only connection, so the request thread never runs extra SQL.
+class SqlStats
+{
+public:
+    SqlStats(const std::string &db_path, uint64_t slow_us) : db_path_(db_path), slow_us_(slow_us)
+    {
+        logger_ = std::thread([this]
+                              { log_loop(); });
+    }
+
+    ~SqlStats()
+    {
+        {
+            std::lock_guard<std::mutex> lk(slow_mu_);
+            stop_ = true;
+        }
+        slow_cv_.notify_one();
+        logger_.join();
+    }
+
+    void record(sqlite3_stmt *stmt, const char *sql, uint64_t us)
+    {
+        if (!sql)
+            return;
+        Entry &e = entry(sql);
+        e.count.fetch_add(1, std::memory_order_relaxed);
+        e.total_us.fetch_add(us, std::memory_order_relaxed);
+        e.buckets[Metrics::bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        // reset so each execution reports only its own work
+        int fullscan = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        int vm = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+        e.fullscan_steps.fetch_add((uint64_t)fullscan, std::memory_order_relaxed);
+        e.vm_steps.fetch_add((uint64_t)vm, std::memory_order_relaxed);
+        if (us < slow_us_)
+            return;
+        char *expanded = sqlite3_expanded_sql(stmt);
+        Slow sl{sql, redact(expanded ? expanded : sql), us, (uint64_t)fullscan, now_iso(), ""};
+        sqlite3_free(expanded);
+        {
+            std::lock_guard<std::mutex> lk(slow_mu_);
+            if (queue_.size() >= 1024)
+                return; // logger is behind; the aggregate stats still count it
+            queue_.push_back(std::move(sl));
+        }
+        slow_cv_.notify_one();
+    }
+
+    json to_json() const
+    {
+        json stmts = json::array();
+        {
+            std::shared_lock<std::shared_mutex> lk(mu_);
+            for (const auto &kv : entries_)
+            {
+                const Entry &e = *kv.second;
+                std::vector<uint64_t> b(Metrics::kBuckets);
+                for (size_t i = 0; i < b.size(); ++i)
+                    b[i] = e.buckets[i].load(std::memory_order_relaxed);
+                uint64_t count = e.count.load(std::memory_order_relaxed);
+                json j;
+                j["sql"] = kv.first;
+                j["count"] = count;
+                j["total_us"] = e.total_us.load(std::memory_order_relaxed);
+                j["p50_us"] = Metrics::quantile(b, 0.50);
+                j["p99_us"] = Metrics::quantile(b, 0.99);
+                j["fullscan_steps"] = e.fullscan_steps.load(std::memory_order_relaxed);
+                j["vm_steps_per_call"] = count ? e.vm_steps.load(std::memory_order_relaxed) / count : 0;
+                stmts.push_back(j);
+            }
+        }
+        std::sort(stmts.begin(), stmts.end(), [](const json &a, const json &b)
+                  { return a["total_us"].get<uint64_t>() > b["total_us"].get<uint64_t>(); });
+        json slow = json::array();
+        {
+            std::lock_guard<std::mutex> lk(slow_mu_);
+            for (const Slow &sl : recent_)
+                slow.push_back({{"time", sl.time}, {"us", sl.us}, {"sql", sl.redacted}, {"fullscan_steps", sl.fullscan}, {"plan", sl.plan}});
+        }
+        json out;
+        out["slow_threshold_us"] = slow_us_;
+        out["statements"] = stmts;
+        out["recent_slow"] = slow;
+        return out;
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<uint64_t> count{0}, total_us{0}, fullscan_steps{0}, vm_steps{0};
+        std::atomic<uint64_t> buckets[Metrics::kBuckets] = {};
+    };
+
+    struct Slow
+    {
+        std::string sql, redacted;
+        uint64_t us, fullscan;
+        std::string time, plan;
+    };
+
+    Entry &entry(const char *sql)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lk(mu_);
+            auto it = entries_.find(sql);
+            if (it != entries_.end())
+                return *it->second;
+        }
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        auto &slot = entries_[sql];
+        if (!slot)
+            slot.reset(new Entry());
+        return *slot;
+    }
+
+    // replace the contents of every '...' literal, keep numbers
+    static std::string redact(const std::string &sql)
+    {
+        std::string out;
+        out.reserve(sql.size());
+        bool in_str = false;
+        for (size_t i = 0; i < sql.size(); ++i)
+        {
+            char c = sql[i];
+            if (!in_str)
+            {
+                out.push_back(c);
+                if (c == '\'')
+                {
+                    in_str = true;
+                    out += "***";
+                }
+            }
+            else if (c == '\'')
+            {
+                if (i + 1 < sql.size() && sql[i + 1] == '\'')
+                    ++i; // escaped quote
+                else
+                {
+                    in_str = false;
+                    out.push_back(c);
+                }
+            }
+        }
+        return out;
+    }
+
+    std::string explain(sqlite3 *ro, const std::string &sql)
+    {
+        auto it = plans_.find(sql);
+        if (it != plans_.end())
+            return it->second;
+        std::string plan;
+        sqlite3_stmt *stmt = nullptr;
+        std::string q = "EXPLAIN QUERY PLAN " + sql;
+        if (ro && sqlite3_prepare_v2(ro, q.c_str(), -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                if (!plan.empty())
+                    plan += "; ";
+                plan += to_str(sqlite3_column_text(stmt, 3));
+            }
+        }
+        sqlite3_finalize(stmt);
+        plans_[sql] = plan;
+        return plan;
+    }
+
+    void log_loop()
+    {
+        sqlite3 *ro = nullptr;
+        if (sqlite3_open_v2(db_path_.c_str(), &ro, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(ro);
+            ro = nullptr;
+        }
+        std::unique_lock<std::mutex> lk(slow_mu_);
+        while (true)
+        {
+            slow_cv_.wait(lk, [this]
+                          { return stop_ || !queue_.empty(); });
+            if (stop_)
+                break;
+            Slow sl = std::move(queue_.front());
+            queue_.pop_front();
+            lk.unlock();
+            sl.plan = explain(ro, sl.sql);
+            std::cerr << "[SLOW SQL] " << sl.us / 1000.0 << " ms fullscan_steps=" << sl.fullscan << " " << sl.redacted
+                      << "\n    plan: " << (sl.plan.empty() ? "-" : sl.plan) << std::endl;
+            lk.lock();
+            recent_.push_back(std::move(sl));
+            if (recent_.size() > 50)
+                recent_.pop_front();
+        }
+        sqlite3_close(ro);
+    }
+
+    std::string db_path_;
+    uint64_t slow_us_;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries_;
+    mutable std::shared_mutex mu_;
+    std::unordered_map<std::string, std::string> plans_; // logger thread only
+    std::deque<Slow> queue_, recent_;
+    bool stop_ = false;
+    mutable std::mutex slow_mu_;
+    std::condition_variable slow_cv_;
+    std::thread logger_;
+};
+
+// sqlite3_trace_v2 hook: per-statement and COMMIT wall time. SQLite's own
+// profile time only has millisecond resolution, so statements are timed
+// with a steady clock from their first step (TRACE_STMT) to completion
+// (TRACE_PROFILE), which happen on the same thread.
+struct SqlProfile
+{
+    Metrics *metrics = nullptr;
+    SqlStats *stats = nullptr;
+    size_t statement_hist = 0, commit_hist = 0;
+};
+
+// trace phase name from the statement's leading keyword
+static const char *sql_phase(const char *sql)
+{
+    static const char *kinds[][2] = {{"SELECT", "sql.select"}, {"INSERT", "sql.insert"}, {"UPDATE", "sql.update"}, {"DELETE", "sql.delete"}, {"BEGIN", "sql.begin"}, {"COMMIT", "sql.commit"}, {"ROLLBACK", "sql.rollback"}};
+    if (sql)
+        for (const auto &k : kinds)
+            if (strncmp(sql, k[0], strlen(k[0])) == 0)
+                return k[1];
+    return "sql.other";
+}
+
+static int sql_profile_cb(unsigned mask, void *ctx, void *p, void *)
+{
+    thread_local std::unordered_map<void *, std::chrono::steady_clock::time_point> started;
+    if (mask == SQLITE_TRACE_STMT)
+    {
+        started.emplace(p, std::chrono::steady_clock::now());
+        return 0;
+    }
+    if (mask != SQLITE_TRACE_PROFILE)
+        return 0;
+    auto it = started.find(p);
+    if (it == started.end())
+        return 0;
+    SqlProfile *prof = static_cast<SqlProfile *>(ctx);
+    const char *sql = sqlite3_sql(static_cast<sqlite3_stmt *>(p));
+    size_t hist = sql && strncmp(sql, "COMMIT", 6) == 0 ? prof->commit_hist : prof->statement_hist;
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - it->second).count();
+    prof->metrics->observe_us(hist, us);
+    if (t_trace)
+        t_trace->add(sql_phase(sql), us);
+    if (prof->stats)
+        prof->stats->record(static_cast<sqlite3_stmt *>(p), sql, us);
+    started.erase(it);
+    return 0;
+}
+
+// --- per-account ledger index
+// Each account keeps its history as running totals of credits and debits in
+// ledger (id) order, plus the time of every entry as UTC epoch seconds.
+// Balance-as-of and net-flow queries become a binary search on the times
+// followed by two array reads instead of a full scan of `transactions`.
+//
+// created_at is local time, which repeats an hour when DST ends, so its
+// string order is not time order. Times are converted on the way in and
+// kept non-decreasing: ids are commit order, so an entry that seems older
+// than the one before it can only be a misread repeated hour.
+class LedgerIndex
+{
+public:
+    struct Flow
+    {
+        double in = 0, out = 0;
+    };
+
+    // record one leg of a ledger write; call in commit order
+    void append(const std::string &acc, const std::string &created_at, double credit, double debit)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        int64_t t = std::max(to_epoch(created_at, &hour_cache_), last_);
+        last_ = t;
+        Entry &e = accounts_[acc];
+        e.times.push_back(t);
+        e.credits.push_back((e.credits.empty() ? 0 : e.credits.back()) + credit);
+        e.debits.push_back((e.debits.empty() ? 0 : e.debits.back()) + debit);
+    }
+
+    bool contains(const std::string &acc) const
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        return accounts_.count(acc) != 0;
+    }
+
+    // true if `ts` is a full "YYYY-MM-DD HH:MM:SS" the queries below accept
+    static bool valid_time(const std::string &ts)
+    {
+        int y, mo, d, h, mi, sec, end = -1;
+        if (std::sscanf(ts.c_str(), "%4d-%2d-%2d %2d:%2d:%2d%n", &y, &mo, &d, &h, &mi, &sec, &end) != 6 || end != (int)ts.size())
+            return false;
+        return mo >= 1 && mo <= 12 && d >= 1 && d <= 31 && h >= 0 && h <= 23 && mi >= 0 && mi <= 59 && sec >= 0 && sec <= 59;
+    }
+
+    // sum of every entry with created_at <= as_of (empty = whole history);
+    // bounds must pass valid_time
+    Flow as_of(const std::string &acc, const std::string &as_of) const
+    {
+        int64_t t = as_of.empty() ? kOpen : to_epoch(as_of);
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = accounts_.find(acc);
+        if (it == accounts_.end())
+            return Flow{};
+        const Entry &e = it->second;
+        size_t n = t == kOpen ? e.times.size() : upper(e, t);
+        return Flow{prefix(e.credits, n), prefix(e.debits, n)};
+    }
+
+    // sum of entries with from <= created_at <= to (empty bound = open)
+    Flow between(const std::string &acc, const std::string &from, const std::string &to) const
+    {
+        int64_t f = from.empty() ? kOpen : to_epoch(from), t = to.empty() ? kOpen : to_epoch(to);
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = accounts_.find(acc);
+        if (it == accounts_.end())
+            return Flow{};
+        const Entry &e = it->second;
+        size_t lo = f == kOpen ? 0 : (size_t)(std::lower_bound(e.times.begin(), e.times.end(), f) - e.times.begin());
+        size_t hi = t == kOpen ? e.times.size() : upper(e, t);
+        if (hi <= lo)
+            return Flow{};
+        return Flow{prefix(e.credits, hi) - prefix(e.credits, lo), prefix(e.debits, hi) - prefix(e.debits, lo)};
+    }
+
+    // build from the full history; returns number of rows indexed
+    size_t load(sqlite3 *db)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT from_account, to_account, amount, created_at FROM transactions ORDER BY id", -1, &stmt, nullptr);
+        size_t rows = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            std::string from = to_str(sqlite3_column_text(stmt, 0));
+            std::string to = to_str(sqlite3_column_text(stmt, 1));
+            double amt = sqlite3_column_double(stmt, 2);
+            std::string ts = to_str(sqlite3_column_text(stmt, 3));
+            if (!from.empty())
+                append(from, ts, 0, amt);
+            if (!to.empty())
+                append(to, ts, amt, 0);
+            ++rows;
+        }
+        sqlite3_finalize(stmt);
+        return rows;
+    }
+
+private:
+    struct Entry
+    {
+        std::vector<int64_t> times;
+        std::vector<double> credits, debits; // running totals
+    };
+
+    // mktime per "YYYY-MM-DD HH", the only unit DST shifts move; loading
+    // millions of rows would otherwise spend its time in the time zone code
+    struct HourCache
+    {
+        char key[13] = {};
+        int64_t start = 0;
+    };
+
+    // no bound; also what to_epoch returns for a time it cannot read, which
+    // append clamps to the entry before
+    static constexpr int64_t kOpen = INT64_MIN;
+
+    // "YYYY-MM-DD HH:MM:SS" in local time -> UTC epoch seconds
+    static int64_t to_epoch(const std::string &ts, HourCache *cache = nullptr)
+    {
+        std::tm tm{};
+        int mins = 0, secs = 0;
+        if (std::sscanf(ts.c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &mins, &secs) < 3)
+            return kOpen;
+        int64_t within = (int64_t)mins * 60 + secs;
+        if (cache && ts.size() >= 13 && std::memcmp(cache->key, ts.data(), 13) == 0)
+            return cache->start + within;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        int64_t start = (int64_t)std::mktime(&tm);
+        if (cache && ts.size() >= 13)
+        {
+            std::memcpy(cache->key, ts.data(), 13);
+            cache->start = start;
+        }
+        return start + within;
+    }
+
+    static double prefix(const std::vector<double> &totals, size_t n) { return n ? totals[n - 1] : 0; }
+
+    static size_t upper(const Entry &e, int64_t t)
+    {
+        return (size_t)(std::upper_bound(e.times.begin(), e.times.end(), t) - e.times.begin());
+    }
+
+    mutable std::shared_mutex mu_;
+    std::unordered_map<std::string, Entry> accounts_;
+    int64_t last_ = 0;     // latest time appended, under mu_
+    HourCache hour_cache_; // under mu_
+};
+
+// --- account cache
+// Account rows grouped by owner, looked up by user id (for /accounts) and by
+// account number (for write-through from the money-moving handlers, which
+// overwrite balances in place so cached rows are never stale). Readers share
+// the lock and only set a CLOCK reference bit; when the byte budget is
+// exceeded the clock hand evicts the first user not referenced since the
+// last sweep.
+class AccountCache
+{
+public:
+    struct Row
+    {
+        std::string account_number, account_type;
+        double balance;
+    };
+
+    explicit AccountCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+    bool get(int user_id, std::vector<Row> &out)
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = by_user_.find(user_id);
+        if (it == by_user_.end())
+        {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot &s = *slots_[it->second];
+        s.ref.store(true, std::memory_order_relaxed);
+        out = s.rows;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void put(int user_id, std::vector<Row> rows)
+    {
+        size_t bytes = footprint(rows);
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        erase_locked(user_id);
+        if (bytes > max_bytes_)
+            return;
+        while (used_bytes_ + bytes > max_bytes_ && evict_one_locked())
+            ;
+        size_t idx;
+        if (free_.empty())
+        {
+            idx = slots_.size();
+            slots_.emplace_back(new Slot);
+        }
+        else
+        {
+            idx = free_.back();
+            free_.pop_back();
+        }
+        Slot &s = *slots_[idx];
+        s.user_id = user_id;
+        s.rows = std::move(rows);
+        s.bytes = bytes;
+        s.live = true;
+        s.ref.store(true, std::memory_order_relaxed);
+        by_user_[user_id] = idx;
+        for (const Row &r : s.rows)
+            by_account_[r.account_number] = idx;
+        used_bytes_ += bytes;
+    }
+
+    // write-through; accounts whose owner is not cached are ignored
+    void set_balance(const std::string &acc, double balance)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        auto it = by_account_.find(acc);
+        if (it == by_account_.end())
+            return;
+        for (Row &r : slots_[it->second]->rows)
+            if (r.account_number == acc)
+                r.balance = balance;
+    }
+
+    void invalidate(int user_id)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        erase_locked(user_id);
+    }
+
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    uint64_t evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        int user_id = 0;
+        std::vector<Row> rows;
+        size_t bytes = 0;
+        bool live = false;
+        std::atomic<bool> ref{false};
+    };
+
+    // rough heap cost: slot, rows, string buffers and the index nodes
+    static size_t footprint(const std::vector<Row> &rows)
+    {
+        size_t b = sizeof(Slot) + 64;
+        for (const Row &r : rows)
+            b += sizeof(Row) + r.account_number.capacity() + r.account_type.capacity() + 64;
+        return b;
+    }
+
+    void erase_locked(int user_id)
+    {
+        auto it = by_user_.find(user_id);
+        if (it == by_user_.end())
+            return;
+        size_t idx = it->second;
+        Slot &s = *slots_[idx];
+        for (const Row &r : s.rows)
+            by_account_.erase(r.account_number);
+        by_user_.erase(it);
+        used_bytes_ -= s.bytes;
+        s.rows.clear();
+        s.live = false;
+        free_.push_back(idx);
+    }
+
+    bool evict_one_locked()
+    {
+        if (by_user_.empty())
+            return false;
+        // at most two sweeps: the first clears reference bits
+        for (size_t n = 0; n < 2 * slots_.size(); ++n)
+        {
+            Slot &s = *slots_[hand_];
+            hand_ = (hand_ + 1) % slots_.size();
+            if (!s.live)
+                continue;
+            if (s.ref.exchange(false, std::memory_order_relaxed))
+                continue;
+            erase_locked(s.user_id);
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    size_t max_bytes_;
+    size_t used_bytes_ = 0;
+    size_t hand_ = 0;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<size_t> free_;
+    std::unordered_map<int, size_t> by_user_;
+    std::unordered_map<std::string, size_t> by_account_;
+    mutable std::shared_mutex mu_;
+    std::atomic<uint64_t> hits_{0}, misses_{0}, evictions_{0};
+};
+
+// --- change versions for conditional GETs
+// Every ledger write bumps one process-wide counter and stamps it on the
+// touched accounts and their owners. ETags combine the stamp with the boot
+// time and pid, so a restart (which forgets the stamps) or another worker
+// process (which counts separately) never yields a false 304.
+class VersionTable
+{
+public:
+    VersionTable() : epoch_(((uint64_t)std::time(nullptr) << 22) | ((uint64_t)getpid() & 0x3fffff)) {}
+
+    // load the account -> owner map once at startup
+    void load(sqlite3 *db)
+    {
+        sqlite3_stmt *stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT account_number, user_id FROM accounts", -1, &stmt, nullptr);
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            owner_[to_str(sqlite3_column_text(stmt, 0))] = sqlite3_column_int(stmt, 1);
+        sqlite3_finalize(stmt);
+    }
+
+    void add_account(const std::string &acc, int user_id)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        owner_[acc] = user_id;
+        uint64_t v = ++seq_;
+        account_[acc] = v;
+        user_[user_id] = v;
+    }
+
+    void bump(const std::string &acc)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        uint64_t v = ++seq_;
+        account_[acc] = v;
+        auto it = owner_.find(acc);
+        if (it != owner_.end())
+            user_[it->second] = v;
+    }
+
+    // owning user id, 0 if unknown
+    int owner(const std::string &acc) const
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = owner_.find(acc);
+        return it == owner_.end() ? 0 : it->second;
+    }
+
+    std::string account_etag(const std::string &acc) const
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = account_.find(acc);
+        return etag('a', it == account_.end() ? 0 : it->second);
+    }
+
+    std::string user_etag(int user_id) const
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = user_.find(user_id);
+        return etag('u', it == user_.end() ? 0 : it->second);
+    }
+
+private:
+    std::string etag(char kind, uint64_t v) const
+    {
+        return "\"" + std::string(1, kind) + std::to_string(epoch_) + "-" + std::to_string(v) + "\"";
+    }
+
+    uint64_t epoch_;
+    uint64_t seq_ = 0;
+    std::unordered_map<std::string, int> owner_;
+    std::unordered_map<std::string, uint64_t> account_;
+    std::unordered_map<int, uint64_t> user_;
+    mutable std::shared_mutex mu_;
+};
+
+// --- ledger change events
+// One committed transactions row. from/to are empty for the missing leg of a
+// deposit or withdrawal; balances are absent when the account row was not
+// found.
+struct LedgerEvent
+{
+    long long seq = 0; // transactions.id
+    std::string tx_uuid, from, to, created_at;
+    double amount = 0;
+    std::optional<double> from_balance, to_balance;
+    int from_user = 0, to_user = 0;
+
+    const char *type() const
+    {
+        if (from.empty())
+            return "deposit";
+        if (to.empty())
+            return "withdraw";
+        return "transfer";
+    }
+
+    // viewer_user limits balances to legs that user owns (0 = show all)
+    json to_json(int viewer_user = 0) const
+    {
+        json j;
+        j["seq"] = seq;
+        j["tx_uuid"] = tx_uuid;
+        j["type"] = type();
+        j["from"] = from;
+        j["to"] = to;
+        j["amount"] = amount;
+        j["time"] = created_at;
+        if (from_balance && (viewer_user == 0 || viewer_user == from_user))
+            j["from_balance"] = *from_balance;
+        if (to_balance && (viewer_user == 0 || viewer_user == to_user))
+            j["to_balance"] = *to_balance;
+        return j;
+    }
+};
+
+// In-process fan-out of ledger events to per-user subscribers. Publishing
+// only takes short locks and never waits on a consumer: each subscriber has
+// a bounded queue, and when it is full the oldest event is dropped and the
+// subscriber is told to resync.
+class ChangeBus
+{
+public:
+    struct Subscriber
+    {
+        int user_id = 0;
+        size_t cap = 0;
+        std::mutex mu;
+        std::condition_variable cv;
+        std::deque<std::shared_ptr<const LedgerEvent>> q;
+        bool overflowed = false;
+    };
+
+    std::shared_ptr<Subscriber> subscribe(int user_id, size_t cap)
+    {
+        auto sub = std::make_shared<Subscriber>();
+        sub->user_id = user_id;
+        sub->cap = std::max<size_t>(cap, 1);
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        subs_[user_id].push_back(sub);
+        return sub;
+    }
+
+    void unsubscribe(const std::shared_ptr<Subscriber> &sub)
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        auto it = subs_.find(sub->user_id);
+        if (it == subs_.end())
+            return;
+        auto &v = it->second;
+        v.erase(std::remove(v.begin(), v.end(), sub), v.end());
+        if (v.empty())
+            subs_.erase(it);
+    }
+
+    void publish(const std::shared_ptr<const LedgerEvent> &ev)
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        deliver(ev, ev->from_user);
+        if (ev->to_user != ev->from_user)
+            deliver(ev, ev->to_user);
+    }
+
+    size_t subscribers() const
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        size_t n = 0;
+        for (const auto &kv : subs_)
+            n += kv.second.size();
+        return n;
+    }
+
+private:
+    void deliver(const std::shared_ptr<const LedgerEvent> &ev, int user_id)
+    {
+        if (user_id == 0)
+            return;
+        auto it = subs_.find(user_id);
+        if (it == subs_.end())
+            return;
+        for (const auto &sub : it->second)
+        {
+            {
+                std::lock_guard<std::mutex> g(sub->mu);
+                if (sub->q.size() >= sub->cap)
+                {
+                    sub->q.pop_front();
+                    sub->overflowed = true;
+                }
+                sub->q.push_back(ev);
+            }
+            sub->cv.notify_one();
+        }
+    }
+
+    std::unordered_map<int, std::vector<std::shared_ptr<Subscriber>>> subs_;
+    mutable std::shared_mutex mu_;
+};
+
+// Ring of the most recent ledger events in commit order, for /changes.
+// Sequences at or below floor() are no longer (or never were) in memory and
+// must be read back from the transactions table.
+class ChangeLog
+{
+public:
+    explicit ChangeLog(size_t cap) : cap_(std::max<size_t>(cap, 1)) {}
+
+    // everything up to last_seq predates this process
+    void prime(long long last_seq)
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        floor_ = last_ = last_seq;
+    }
+
+    void append(const std::shared_ptr<const LedgerEvent> &ev)
+    {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (ring_.size() >= cap_)
+            {
+                floor_ = ring_.front()->seq;
+                ring_.pop_front();
+            }
+            ring_.push_back(ev);
+            last_ = ev->seq;
+        }
+        cv_.notify_all();
+    }
+
+    // false if `after` is older than the ring; the caller falls back to SQLite
+    bool read_after(long long after, size_t limit, std::vector<std::shared_ptr<const LedgerEvent>> &out) const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (after < floor_)
+            return false;
+        auto it = std::upper_bound(ring_.begin(), ring_.end(), after,
+                                   [](long long s, const std::shared_ptr<const LedgerEvent> &e)
+                                   { return s < e->seq; });
+        for (; it != ring_.end() && out.size() < limit; ++it)
+            out.push_back(*it);
+        return true;
+    }
+
+    // block until something newer than `after` is committed or timeout
+    bool wait_after(long long after, std::chrono::milliseconds timeout) const
+    {
+        std::unique_lock<std::mutex> lk(mu_);
+        return cv_.wait_for(lk, timeout, [&]
+                            { return last_ > after; });
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        return ring_.size();
+    }
+
+private:
+    size_t cap_;
+    long long floor_ = 0, last_ = 0;
+    std::deque<std::shared_ptr<const LedgerEvent>> ring_;
+    mutable std::mutex mu_;
+    mutable std::condition_variable cv_;
+};
+
+// true if If-None-Match lists this ETag (or is "*")
+static bool etag_matches(const httplib::Request &req, const std::string &etag)
+{
+    std::string inm = req.get_header_value("If-None-Match");
+    if (inm.empty())
+        return false;
+    std::istringstream ss(inm);
+    std::string tok;
+    while (std::getline(ss, tok, ','))
+    {
+        size_t b = tok.find_first_not_of(" \t");
+        size_t e = tok.find_last_not_of(" \t");
+        if (b == std::string::npos)
+            continue;
+        tok = tok.substr(b, e - b + 1);
+        if (tok.compare(0, 2, "W/") == 0)
+            tok = tok.substr(2);
+        if (tok == "*" || tok == wire_etag(etag))
+            return true;
+    }
+    return false;
+}
+
+// "YYYY-MM-DD" -> start/end of that day; full timestamps pass through
+static std::string day_bound(const std::string &d, bool end_of_day)
+{
+    if (d.size() == 10)
+        return d + (end_of_day ? " 23:59:59" : " 00:00:00");
+    return d;
+}
+
+// --- admission control
+// Handlers run only while holding one of `slots` execution slots. Requests
+// fall into three classes: money movement, reads (everything interactive)
+// and exports/analytics. Each class waits in its own bounded queue, ordered
+// by deadline; when a slot frees, money goes first, then reads, then
+// exports. Reads and exports never take the last `reserve` slots, and
+// exports never hold more than `export_slots`, so an export storm cannot
+// delay transfers behind it. A full queue answers 503 at once, and a
+// request whose deadline passes before it starts is answered 504 without
+// running. The deadline is X-Request-Timeout-Ms (or max_wait when absent)
+// after the server has the whole request.
+class Admission
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    enum Class : uint8_t
+    {
+        Money,
+        Reads,
+        Exports,
+        kClasses,
+        Exempt = kClasses // health, metrics, debug, /stream and /changes long polls
+    };
+    enum class Verdict
+    {
+        Run,        // a slot is held until finish()
+        Queued,     // the grant callback will be called later, exactly once
+        Overloaded, // the class queue is full
+        Expired     // the deadline passed before a slot was free
+    };
+    using Grant = std::function<void(Verdict)>;
+    static constexpr const char *kClassNames[kClasses] = {"money", "reads", "exports"};
+
+    Admission(Metrics &m, size_t slots, size_t reserve, size_t export_slots, size_t queue, size_t export_queue, long max_wait_ms)
+        : metrics_(m), slots_(slots), reserve_(std::min(reserve, slots > 0 ? slots - 1 : 0)),
+          export_slots_(std::max<size_t>(1, export_slots)), max_wait_(std::chrono::milliseconds(max_wait_ms))
+    {
+        for (int c = 0; c < kClasses; ++c)
+        {
+            std::string lb = std::string("class=\"") + kClassNames[c] + "\"";
+            bound_[c] = c == Exports ? export_queue : queue;
+            admitted_[c] = m.counter("minibank_admission_total", "Requests by class and admission outcome.", lb + ",outcome=\"admitted\"");
+            rejected_[c] = m.counter("minibank_admission_total", "Requests by class and admission outcome.", lb + ",outcome=\"rejected\"");
+            expired_[c] = m.counter("minibank_admission_total", "Requests by class and admission outcome.", lb + ",outcome=\"expired\"");
+            wait_[c] = m.histogram("minibank_admission_wait_seconds", "Time a request queued for an execution slot.", lb);
+        }
+        m.gauge("minibank_admission_running", "Requests holding an execution slot.", [this]
+                {
+            std::lock_guard<std::mutex> lk(mu_);
+            return (double)total_; });
+        m.gauge("minibank_admission_queued", "Requests waiting for an execution slot.", [this]
+                {
+            std::lock_guard<std::mutex> lk(mu_);
+            size_t n = 0;
+            for (const auto &q : queues_)
+                n += q.size();
+            return (double)n; });
+    }
+
+    bool enabled() const { return slots_ > 0; }
+
+    static Class classify(std::string_view method, std::string_view path)
+    {
+        auto starts = [&](const char *p)
+        { return path.compare(0, std::strlen(p), p) == 0; };
+        if (method == "POST")
+            return path == "/deposit" || path == "/withdraw" || path == "/transfer" ? Money : Reads;
+        if (path == "/" || path == "/metrics" || path == "/changes" || starts("/debug/") || starts("/stream/"))
+            return Exempt;
+        if (starts("/export_transactions/") || starts("/flow/"))
+            return Exports;
+        return Reads;
+    }
+
+    // X-Request-Timeout-Ms counted from `received`; absent or unparsable
+    // means max_wait
+    Clock::time_point deadline(std::string_view timeout_ms, Clock::time_point received) const
+    {
+        long ms = -1;
+        if (!timeout_ms.empty())
+        {
+            auto r = std::from_chars(timeout_ms.data(), timeout_ms.data() + timeout_ms.size(), ms);
+            if (r.ec != std::errc())
+                ms = -1;
+        }
+        return received + (ms >= 0 ? std::chrono::milliseconds(ms) : max_wait_);
+    }
+
+    // Run and the rejections are decided here and returned; Queued means
+    // `grant` runs later on whichever thread frees a slot or expires it
+    Verdict submit(Class c, Clock::time_point deadline, Grant grant)
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (deadline <= Clock::now())
+        {
+            metrics_.inc(expired_[c]);
+            return Verdict::Expired;
+        }
+        if (queues_[c].empty() && fits(c))
+        {
+            take(c);
+            metrics_.observe_us(wait_[c], 0);
+            return Verdict::Run;
+        }
+        if (queues_[c].size() >= bound_[c])
+        {
+            metrics_.inc(rejected_[c]);
+            return Verdict::Overloaded;
+        }
+        queues_[c].emplace(deadline, Waiter{std::move(grant), Clock::now()});
+        return Verdict::Queued;
+    }
+
+    // submit() for a thread that already holds its request (the threads
+    // front end): waits for the verdict, and for its deadline
+    Verdict admit(Class c, Clock::time_point deadline)
+    {
+        struct Wait
+        {
+            std::mutex mu;
+            std::condition_variable cv;
+            std::optional<Verdict> v;
+        };
+        auto w = std::make_shared<Wait>();
+        Verdict v = submit(c, deadline, [w](Verdict v)
+                           {
+            std::lock_guard<std::mutex> lk(w->mu);
+            w->v = v;
+            w->cv.notify_one(); });
+        if (v != Verdict::Queued)
+            return v;
+        std::unique_lock<std::mutex> lk(w->mu);
+        while (!w->v)
+            if (w->cv.wait_until(lk, deadline) == std::cv_status::timeout && !w->v)
+            {
+                lk.unlock();
+                expire();
+                lk.lock();
+            }
+        return *w->v;
+    }
+
+    // releases a slot taken by Run and hands it on
+    void finish(Class c)
+    {
+        std::vector<std::pair<Grant, Verdict>> out;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            --running_[c];
+            --total_;
+            hand_out(out);
+        }
+        for (auto &g : out)
+            g.first(g.second);
+    }
+
+    // for a request admitted earlier (a pipelined one behind its batch's
+    // first): whether its own deadline has passed meanwhile
+    Verdict check(Class c, Clock::time_point deadline)
+    {
+        if (deadline > Clock::now())
+            return Verdict::Run;
+        metrics_.inc(expired_[c]);
+        return Verdict::Expired;
+    }
+
+    // HTTP status and error reason for a request turned away
+    static const char *refusal(Verdict v, int &status)
+    {
+        status = v == Verdict::Overloaded ? 503 : 504;
+        return v == Verdict::Overloaded ? "overloaded" : "deadline_exceeded";
+    }
+
+    // answers every queued request whose deadline has passed
+    void expire()
+    {
+        std::vector<std::pair<Grant, Verdict>> out;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto now = Clock::now();
+            for (int c = 0; c < kClasses; ++c)
+                while (!queues_[c].empty() && queues_[c].begin()->first <= now)
+                {
+                    out.emplace_back(std::move(queues_[c].begin()->second.grant), Verdict::Expired);
+                    queues_[c].erase(queues_[c].begin());
+                    metrics_.inc(expired_[c]);
+                }
+        }
+        for (auto &g : out)
+            g.first(g.second);
+    }
+
+private:
+    struct Waiter
+    {
+        Grant grant;
+        Clock::time_point queued;
+    };
+
+    bool fits(Class c) const
+    {
+        return total_ < slots_ && (c == Money || total_ < slots_ - reserve_) && (c != Exports || running_[Exports] < export_slots_);
+    }
+
+    void take(Class c)
+    {
+        ++running_[c];
+        ++total_;
+        metrics_.inc(admitted_[c]);
+    }
+
+    // highest class first, earliest deadline first within a class; mu_ is held
+    void hand_out(std::vector<std::pair<Grant, Verdict>> &out)
+    {
+        auto now = Clock::now();
+        for (int c = 0; c < kClasses; ++c)
+            while (!queues_[c].empty() && fits((Class)c))
+            {
+                auto it = queues_[c].begin();
+                if (it->first <= now)
+                {
+                    out.emplace_back(std::move(it->second.grant), Verdict::Expired);
+                    metrics_.inc(expired_[c]);
+                }
+                else
+                {
+                    take((Class)c);
+                    metrics_.observe_us(wait_[c], (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.queued).count());
+                    out.emplace_back(std::move(it->second.grant), Verdict::Run);
+                }
+                queues_[c].erase(it);
+            }
+    }
+
+    Metrics &metrics_;
+    const size_t slots_, reserve_, export_slots_;
+    const Clock::duration max_wait_;
+    size_t bound_[kClasses];
+    size_t admitted_[kClasses], rejected_[kClasses], expired_[kClasses], wait_[kClasses];
+    std::mutex mu_;
+    size_t running_[kClasses] = {}, total_ = 0;
+    std::multimap<Clock::time_point, Waiter> queues_[kClasses];
+};
+
+// set by the epoll front end while it serves requests admitted at dispatch
+thread_local bool t_admitted = false;
+thread_local Admission::Clock::time_point t_received;
+
+// --- query budgets
+// Reads that can run long (a big account's history or export) get a time
+// budget and stop when their client hangs up. All handlers share one
+// connection, so sqlite3_interrupt() is out: it would also abort whatever
+// transfer happens to be stepping. Instead a progress handler checks the
+// state of the thread that is stepping and fails only that statement with
+// SQLITE_INTERRUPT. Read-only statements are not rolled back on interrupt,
+// so an open write transaction elsewhere is unaffected.
+//
+// timed() sets each request's budget; a handler arms it with a Scope around
+// the statements it knows how to cut short (returning partial pages or an
+// error), so nothing that fills a cache ever sees a truncated result.
+class QueryBudget
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    enum Reason : uint8_t
+    {
+        None,
+        Timeout,      // the request's budget ran out
+        ClientClosed, // the peer hung up
+        kReasons
+    };
+    static constexpr const char *kReasonNames[kReasons] = {"", "timeout", "client_closed"};
+
+    // 0 ms = no budget for that class
+    QueryBudget(Metrics &m, long read_ms, long export_ms)
+        : metrics_(m), read_(std::chrono::milliseconds(read_ms)), export_(std::chrono::milliseconds(export_ms))
+    {
+        for (int r = Timeout; r < kReasons; ++r)
+            stopped_[r] = m.counter("minibank_query_interrupted_total", "SQLite reads stopped early, by reason.",
+                                    std::string("reason=\"") + kReasonNames[r] + "\"");
+    }
+
+    void install(sqlite3 *db) { sqlite3_progress_handler(db, kOps, &QueryBudget::progress, this); }
+
+    // per request, on the thread that runs the handler: the budget runs from
+    // `received` and never past `deadline`, the client's own timeout
+    void begin(Admission::Class c, Clock::time_point received, Clock::time_point deadline, int client_fd)
+    {
+        Clock::duration d = c == Admission::Exports ? export_ : c == Admission::Reads ? read_ : Clock::duration::zero();
+        t_.deadline = std::min(deadline, d > Clock::duration::zero() ? received + d : Clock::time_point::max());
+        t_.fd = client_fd;
+        t_.next_poll = Clock::now() + kPollEvery;
+    }
+
+    void end() { t_ = State(); }
+
+    // statements stepped while a Scope is alive may be interrupted
+    class Scope
+    {
+    public:
+        Scope()
+        {
+            t_.armed = true;
+            t_.stopped = None;
+        }
+        ~Scope() { t_.armed = false; }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        // why the last statement ended early, or None
+        Reason stopped() const { return t_.stopped; }
+    };
+
+    // the error response for a read stopped with nothing useful to return;
+    // a closed client never sees it, the status is for logs and captures
+    static void refuse(Reason r, httplib::Response &res)
+    {
+        res.status = r == Timeout ? 504 : 499;
+        res.set_content(r == Timeout ? R"({"status":"error","reason":"query_budget_exceeded"})"
+                                     : R"({"status":"error","reason":"client_closed"})",
+                        "application/json");
+    }
+
+private:
+    // one check per this many VM instructions; tens of microseconds apart
+    static constexpr int kOps = 1000;
+    // how often the client socket is polled while a statement runs
+    static constexpr Clock::duration kPollEvery = std::chrono::milliseconds(20);
+
+    struct State
+    {
+        Clock::time_point deadline = Clock::time_point::max(), next_poll;
+        int fd = -1;
+        bool armed = false;
+        Reason stopped = None;
+    };
+    static thread_local State t_;
+
+    static int progress(void *arg)
+    {
+        State &s = t_;
+        if (!s.armed)
+            return 0;
+        if (s.stopped == None)
+        {
+            auto now = Clock::now();
+            if (now >= s.deadline)
+                s.stopped = Timeout;
+            else if (s.fd >= 0 && now >= s.next_poll)
+            {
+                s.next_poll = now + kPollEvery;
+                // EPOLLRDHUP's poll twin: sees the FIN without reading, so
+                // pipelined bytes stay where the front end expects them
+                pollfd p{s.fd, POLLRDHUP, 0};
+                if (::poll(&p, 1, 0) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+                    s.stopped = ClientClosed;
+            }
+            if (s.stopped == None)
+                return 0;
+            QueryBudget *self = static_cast<QueryBudget *>(arg);
+            self->metrics_.inc(self->stopped_[s.stopped]);
+        }
+        return 1;
+    }
+
+    Metrics &metrics_;
+    const Clock::duration read_, export_;
+    size_t stopped_[kReasons] = {};
+};
+
+thread_local QueryBudget::State QueryBudget::t_;
+
+// the socket of the request this thread is serving, for QueryBudget
+thread_local int t_client_fd = -1;
+
+// --- worker pool
+// Both front ends run handlers on WorkerPool (through new_task_queue) rather
+// than httplib's ThreadPool, fixed at CPPHTTPLIB_THREAD_POOL_COUNT threads.
+// A pool keeps between MINIBANK_POOL_MIN and MINIBANK_POOL_MAX workers: a
+// task that finds no idle worker starts one if the pool is below its target,
+// and a worker exits after MINIBANK_POOL_IDLE_MS without work, or as soon as
+// it is idle while the pool is above target, never going below the minimum.
+//
+// The target follows how the workers spend their time. Every tick the
+// controller reads each worker's /proc schedstat and splits its time inside
+// tasks into running, waiting for a CPU, and blocked (SQLite I/O and busy
+// waits, the ledger mutex, slow clients). Only blocked time can be overlapped
+// by more threads, so target = cpus * (1 + blocked / running): CPU-bound work
+// settles near a thread per CPU, and runqueue waits count as neither, so an
+// oversubscribed pool shrinks instead of adding context switches. A task
+// that has waited a whole tick gets a thread of its own regardless (up to the
+// maximum): the threads front end holds a worker per keep-alive connection,
+// and a new client must not wait for another to go away.
+//
+// MINIBANK_POOL_AFFINITY=cpu pins each worker to one CPU, filling the node
+// the server started on first so a small pool shares one node's caches and
+// memory; =node binds workers round robin to whole nodes, so what a worker
+// allocates stays local to it while the kernel balances within the node.
+class WorkerPool : public httplib::TaskQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    enum class Placement
+    {
+        None,
+        Cpu,
+        Node
+    };
+
+    // what every pool in the process shares: bounds, CPU placement, the
+    // controller and the metrics. listen() and the Unix socket each make a
+    // pool; they get one target and the gauges add them up.
+    class Group
+    {
+    public:
+        static constexpr Clock::duration kTick = std::chrono::milliseconds(250);
+
+        Group(Metrics &m, size_t min_threads, size_t max_threads, long idle_ms, Placement placement)
+            : metrics_(m), min_(std::max<size_t>(1, min_threads)), max_(std::max(min_, max_threads)),
+              idle_(std::chrono::milliseconds(std::max(1L, idle_ms))), target_(max_), placement_(placement)
+        {
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            sched_getaffinity(0, sizeof(allowed), &allowed);
+            cpus_ = std::max(1, CPU_COUNT(&allowed));
+            std::vector<std::vector<int>> nodes = numa_nodes(allowed);
+            nodes_ = nodes.size();
+            for (const auto &node : nodes)
+            {
+                if (placement == Placement::Cpu)
+                    for (int cpu : node)
+                    {
+                        slots_.emplace_back();
+                        CPU_ZERO(&slots_.back());
+                        CPU_SET(cpu, &slots_.back());
+                    }
+                else if (placement == Placement::Node)
+                {
+                    slots_.emplace_back();
+                    CPU_ZERO(&slots_.back());
+                    for (int cpu : node)
+                        CPU_SET(cpu, &slots_.back());
+                }
+            }
+            slot_load_.assign(slots_.size(), 0);
+            std::FILE *f = std::fopen("/proc/thread-self/schedstat", "r");
+            schedstat_ = f != nullptr;
+            if (f)
+                std::fclose(f);
+
+            grown_ = m.counter("minibank_pool_resizes_total", "Worker pool threads started and stopped, by reason.", "action=\"grow\",reason=\"queue\"");
+            starved_ = m.counter("minibank_pool_resizes_total", "Worker pool threads started and stopped, by reason.", "action=\"grow\",reason=\"starved\"");
+            shrunk_idle_ = m.counter("minibank_pool_resizes_total", "Worker pool threads started and stopped, by reason.", "action=\"shrink\",reason=\"idle\"");
+            shrunk_target_ = m.counter("minibank_pool_resizes_total", "Worker pool threads started and stopped, by reason.", "action=\"shrink\",reason=\"over_target\"");
+            m.gauge("minibank_pool_threads", "Worker pool threads.", [this]
+                    { return (double)sum([](const WorkerPool &p) { return p.threads_; }); });
+            m.gauge("minibank_pool_busy_threads", "Worker pool threads running a task.", [this]
+                    { return (double)sum([](const WorkerPool &p) { return p.threads_ - p.idle_; }); });
+            m.gauge("minibank_pool_queued", "Tasks waiting for a worker.", [this]
+                    { return (double)sum([](const WorkerPool &p) { return p.jobs_.size(); }); });
+            m.gauge("minibank_pool_target_threads", "Threads the pool may grow to, from the measured blocking.", [this]
+                    { return (double)target_.load(); });
+            m.gauge("minibank_pool_blocked_ratio", "Share of worker time in tasks spent blocked (not on or waiting for a CPU).", [this]
+                    { std::lock_guard<std::mutex> lk(mu_); return busy_ > 0 ? blocked_ / busy_ : 0.0; });
+            m.gauge("minibank_pool_runqueue_ratio", "Share of worker time in tasks spent waiting for a CPU.", [this]
+                    { std::lock_guard<std::mutex> lk(mu_); return busy_ > 0 ? wait_ / busy_ : 0.0; });
+        }
+
+        ~Group()
+        {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            if (controller_.joinable())
+                controller_.join();
+        }
+
+        // for Server::new_task_queue
+        httplib::TaskQueue *make()
+        {
+            auto *p = new WorkerPool(*this);
+            std::lock_guard<std::mutex> lk(mu_);
+            pools_.push_back(p);
+            if (!controller_.joinable())
+                controller_ = std::thread([this]
+                                          { control(); });
+            return p;
+        }
+
+        static Placement placement(const std::string &s)
+        {
+            return s == "cpu" ? Placement::Cpu : s == "node" ? Placement::Node : Placement::None;
+        }
+
+        std::string describe() const
+        {
+            std::ostringstream o;
+            o << min_ << ".." << max_ << " workers on " << cpus_ << " CPUs in " << nodes_ << " NUMA node" << (nodes_ == 1 ? "" : "s");
+            if (placement_ != Placement::None)
+                o << (placement_ == Placement::Cpu ? ", one CPU each" : ", bound to nodes round robin");
+            if (!schedstat_)
+                o << ", no schedstat: sized by queue depth only";
+            return o.str();
+        }
+
+    private:
+        friend class WorkerPool;
+
+        // CPUs of each NUMA node that this process may run on, the node it
+        // is running on now first; one node when sysfs has no topology
+        static std::vector<std::vector<int>> numa_nodes(const cpu_set_t &allowed)
+        {
+            auto parse = [](const std::string &list)
+            {
+                std::vector<int> out;
+                std::stringstream ss(list);
+                for (std::string r; std::getline(ss, r, ',');)
+                {
+                    int lo = 0, hi = -1;
+                    if (std::sscanf(r.c_str(), "%d-%d", &lo, &hi) < 2)
+                        hi = lo;
+                    for (int c = lo; c <= hi; ++c)
+                        out.push_back(c);
+                }
+                return out;
+            };
+            auto slurp = [](const std::string &path)
+            {
+                std::ifstream in(path);
+                std::string s;
+                std::getline(in, s);
+                return s;
+            };
+            std::vector<std::vector<int>> nodes;
+            int here = -1, cur = sched_getcpu();
+            for (int n : parse(slurp("/sys/devices/system/node/online")))
+            {
+                std::vector<int> cpus;
+                for (int c : parse(slurp("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist")))
+                    if (c >= 0 && c < CPU_SETSIZE && CPU_ISSET(c, &allowed))
+                    {
+                        cpus.push_back(c);
+                        if (c == cur)
+                            here = (int)nodes.size();
+                    }
+                if (!cpus.empty())
+                    nodes.push_back(std::move(cpus));
+            }
+            if (nodes.empty())
+            {
+                nodes.emplace_back();
+                for (int c = 0; c < CPU_SETSIZE; ++c)
+                    if (CPU_ISSET(c, &allowed))
+                        nodes.back().push_back(c);
+            }
+            else if (here > 0)
+                std::rotate(nodes.begin(), nodes.begin() + here, nodes.begin() + here + 1);
+            return nodes;
+        }
+
+        // the least used placement slot, earliest first; -1 when not pinning
+        int take_slot()
+        {
+            std::lock_guard<std::mutex> lk(slot_mu_);
+            if (slots_.empty())
+                return -1;
+            size_t best = 0;
+            for (size_t i = 1; i < slots_.size(); ++i)
+                if (slot_load_[i] < slot_load_[best])
+                    best = i;
+            ++slot_load_[best];
+            return (int)best;
+        }
+
+        void release_slot(int slot)
+        {
+            if (slot < 0)
+                return;
+            std::lock_guard<std::mutex> lk(slot_mu_);
+            --slot_load_[slot];
+        }
+
+        // on the worker's own thread
+        void place(int slot) const
+        {
+            if (slot >= 0)
+                sched_setaffinity(0, sizeof(cpu_set_t), &slots_[slot]);
+        }
+
+        void forget(WorkerPool *p)
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            pools_.erase(std::remove(pools_.begin(), pools_.end(), p), pools_.end());
+        }
+
+        template <class F>
+        size_t sum(F f)
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            size_t n = 0;
+            for (WorkerPool *p : pools_)
+            {
+                std::lock_guard<std::mutex> plk(p->mu_);
+                n += f(*p);
+            }
+            return n;
+        }
+
+        // every tick: join exited workers, then move the target toward
+        // cpus * (1 + blocked / running), smoothed over about a second
+        void control()
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            while (!cv_.wait_for(lk, kTick, [this]
+                                 { return stop_; }))
+            {
+                uint64_t busy = 0, run = 0, wait = 0;
+                for (WorkerPool *p : pools_)
+                {
+                    p->reap();
+                    p->unstick();
+                    if (schedstat_)
+                        p->sample(busy, run, wait);
+                }
+                if (busy < (uint64_t)std::chrono::nanoseconds(kTick).count() / 50)
+                    continue; // too little work to say anything
+                double blocked = (double)busy - (double)run - (double)wait;
+                busy_ = 0.7 * busy_ + 0.3 * (double)busy;
+                run_ = 0.7 * run_ + 0.3 * (double)run;
+                wait_ = 0.7 * wait_ + 0.3 * (double)wait;
+                blocked_ = 0.7 * blocked_ + 0.3 * std::max(0.0, blocked);
+                double want = run_ > 0 ? std::ceil(cpus_ * (1 + blocked_ / run_)) : (double)max_;
+                size_t t = (size_t)std::clamp(want, (double)min_, (double)max_);
+                if (t != target_.exchange(t))
+                    for (WorkerPool *p : pools_)
+                        p->retarget();
+            }
+        }
+
+        Metrics &metrics_;
+        const size_t min_, max_;
+        const Clock::duration idle_;
+        std::atomic<size_t> target_;
+        const Placement placement_;
+        int cpus_ = 1;
+        size_t nodes_ = 1;
+        bool schedstat_ = false;
+        std::vector<cpu_set_t> slots_;
+        std::mutex slot_mu_;
+        std::vector<int> slot_load_;
+        size_t grown_, starved_, shrunk_idle_, shrunk_target_;
+
+        std::mutex mu_; // before any pool's mu_
+        std::condition_variable cv_;
+        std::vector<WorkerPool *> pools_;
+        std::thread controller_;
+        bool stop_ = false;
+        // smoothed ns per tick, all pools
+        double busy_ = 0, run_ = 0, wait_ = 0, blocked_ = 0;
+    };
+
+    explicit WorkerPool(Group &g) : group_(g)
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        while (threads_ < group_.min_ && spawn_locked())
+            ;
+    }
+
+    ~WorkerPool() override { shutdown(); }
+
+    bool enqueue(std::function<void()> fn) override
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (shutdown_)
+            return false;
+        jobs_.emplace_back(Clock::now(), std::move(fn));
+        if (jobs_.size() > idle_ && threads_ < group_.target_.load() && spawn_locked())
+            group_.metrics_.inc(group_.grown_);
+        cv_.notify_one();
+        return true;
+    }
+
+    // runs what is queued, then joins every worker
+    void shutdown() override
+    {
+        group_.forget(this);
+        std::list<std::unique_ptr<Worker>> all;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            shutdown_ = true;
+            all.swap(workers_);
+        }
+        cv_.notify_all();
+        for (auto &w : all)
+            w->thread.join();
+    }
+
+private:
+    struct Worker
+    {
+        std::thread thread;
+        std::atomic<pid_t> tid{0};
+        int slot = -1;
+        bool done = false; // under mu_: left its loop, ready to join
+        // ns inside tasks, and when the current one started (0 when idle)
+        std::atomic<int64_t> busy_ns{0}, since_ns{0};
+        // the controller's previous reading
+        int64_t seen_busy = 0;
+        uint64_t seen_run = 0, seen_wait = 0;
+    };
+
+    static int64_t now_ns() { return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count(); }
+
+    bool spawn_locked()
+    {
+        auto w = std::make_unique<Worker>();
+        Worker *wp = w.get();
+        wp->slot = group_.take_slot();
+        try
+        {
+            wp->thread = std::thread([this, wp]
+                                     { run(wp); });
+        }
+        catch (const std::system_error &)
+        {
+            group_.release_slot(wp->slot);
+            return false; // out of threads; the queue waits for the ones we have
+        }
+        ++threads_;
+        workers_.push_back(std::move(w));
+        return true;
+    }
+
+    void run(Worker *w)
+    {
+        w->tid = (pid_t)syscall(SYS_gettid);
+        group_.place(w->slot);
+        std::unique_lock<std::mutex> lk(mu_);
+        while (true)
+        {
+            ++idle_;
+            bool woke = cv_.wait_for(lk, group_.idle_, [this]
+                                     { return !jobs_.empty() || shutdown_ || over_target_locked(); });
+            --idle_;
+            if (jobs_.empty())
+            {
+                if (shutdown_)
+                    break;
+                if (over_target_locked())
+                {
+                    group_.metrics_.inc(group_.shrunk_target_);
+                    break;
+                }
+                if (!woke && threads_ > group_.min_)
+                {
+                    group_.metrics_.inc(group_.shrunk_idle_);
+                    break;
+                }
+                continue;
+            }
+            std::function<void()> fn = std::move(jobs_.front().second);
+            jobs_.pop_front();
+            lk.unlock();
+            int64_t t0 = now_ns();
+            w->since_ns = t0;
+            fn();
+            w->busy_ns += now_ns() - t0;
+            w->since_ns = 0;
+            lk.lock();
+        }
+        --threads_;
+        group_.release_slot(w->slot);
+        w->done = true; // the last touch: reap() may free it from here on
+    }
+
+    bool over_target_locked() const { return threads_ > std::max(group_.min_, group_.target_.load()); }
+
+    // controller, under the group's mu_: join workers that exited
+    void reap()
+    {
+        std::list<std::unique_ptr<Worker>> done;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto it = workers_.begin(); it != workers_.end();)
+            {
+                auto next = std::next(it);
+                if ((*it)->done)
+                    done.splice(done.end(), workers_, it);
+                it = next;
+            }
+        }
+        for (auto &w : done)
+            w->thread.join();
+    }
+
+    // controller, under the group's mu_ (so no worker record is freed
+    // meanwhile): adds each worker's ns in tasks, on a CPU and waiting for
+    // one since the last tick
+    void sample(uint64_t &busy, uint64_t &run, uint64_t &wait)
+    {
+        std::vector<Worker *> live;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (auto &w : workers_)
+                if (!w->done)
+                    live.push_back(w.get());
+        }
+        int64_t now = now_ns();
+        for (Worker *w : live)
+        {
+            unsigned long long r = 0, q = 0;
+            std::FILE *f = std::fopen(("/proc/self/task/" + std::to_string(w->tid.load()) + "/schedstat").c_str(), "r");
+            if (!f)
+                continue;
+            bool ok = std::fscanf(f, "%llu %llu", &r, &q) == 2;
+            std::fclose(f);
+            if (!ok)
+                continue;
+            int64_t since = w->since_ns.load(), total = w->busy_ns.load() + (since ? now - since : 0);
+            // an idle worker's run time is noise; count only while busy
+            if (total > w->seen_busy)
+            {
+                busy += (uint64_t)(total - w->seen_busy);
+                run += r - std::min<uint64_t>(r, w->seen_run);
+                wait += q - std::min<uint64_t>(q, w->seen_wait);
+            }
+            w->seen_busy = total;
+            w->seen_run = r;
+            w->seen_wait = q;
+        }
+    }
+
+    // controller: a thread for every task queued since before the last tick
+    void unstick()
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto stale = Clock::now() - Group::kTick;
+        size_t waiting = 0;
+        for (const auto &j : jobs_)
+        {
+            if (j.first > stale)
+                break;
+            ++waiting;
+        }
+        for (size_t n = waiting > idle_ ? waiting - idle_ : 0; n > 0 && threads_ < group_.max_ && spawn_locked(); --n)
+            group_.metrics_.inc(group_.starved_);
+    }
+
+    // controller, after the group target moved
+    void retarget()
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (over_target_locked())
+            cv_.notify_all(); // idle workers above target exit
+        else
+            while (jobs_.size() > idle_ && threads_ < group_.target_.load() && spawn_locked())
+                group_.metrics_.inc(group_.grown_);
+    }
+
+    Group &group_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::pair<Clock::time_point, std::function<void()>>> jobs_; // with when queued
+    std::list<std::unique_ptr<Worker>> workers_;
+    size_t threads_ = 0, idle_ = 0;
+    bool shutdown_ = false;
+};
+
+// --- epoll front end
+// MINIBANK_FRONTEND=epoll serves the same routes without a thread per
+// connection. I/O threads each run an edge-triggered epoll loop that reads
+// into per-connection buffers and finds request boundaries (headers plus
+// Content-Length, or the end of a chunked body). A complete request goes to
+// the WorkerPool (new_task_queue(), as for the threads front end), which
+// runs httplib's own process_request over the buffered bytes, so routing,
+// handlers and response encoding are unchanged. The worker writes the
+// response straight to the non-blocking socket and only waits for
+// writability when the kernel buffer is full; streamed responses (/stream,
+// exports) still hold a worker while they run. A connection has at most one
+// task in flight; bytes that arrive meanwhile stay buffered.
+//
+// Both front ends accept pipelined HTTP/1.1: requests a client sends without
+// waiting are answered in order, and responses are held until the connection
+// would otherwise wait for the client, so a run of pipelined responses (and
+// each response's header and body) leaves in one gathered write.
+class EpollServer : public httplib::Server
+{
+public:
+    static constexpr size_t kMaxBuffered = 16 << 20;
+    static constexpr size_t kMaxHeader = 8192;
+    static constexpr size_t kMaxPipelined = 64; // requests per epoll task
+
+    // blocks like listen(); returns false if the socket cannot be bound
+    bool listen_epoll(const std::string &host, int port, int io_threads)
+    {
+        return bind_epoll(host, port) && serve_epoll(io_threads);
+    }
+
+    bool bind_epoll(const std::string &host, int port)
+    {
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+        if (listen_fd_ < 0 || ::bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listen_fd_, 4096) < 0)
+        {
+            if (listen_fd_ >= 0)
+                ::close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // serve a listening socket inherited from a predecessor (see Handoff)
+    void adopt_epoll(int fd) { listen_fd_ = fd; }
+    void adopt(int fd) { svr_sock_ = fd; }
+    int listener() const { return listen_fd_ >= 0 ? listen_fd_ : (int)svr_sock_; }
+
+    // stops accepting without shutting the listening socket down, which would
+    // also stop a successor holding a duplicate of it. Every connection gets
+    // one more response, marked Connection: close, or is closed once idle;
+    // then listen() or serve_epoll() returns. The threads front end only
+    // notices between accepts, so it needs set_idle_interval().
+    void release_listener()
+    {
+        released_ = true;
+        svr_sock_ = INVALID_SOCKET;
+        // loops that have not started yet will see released_ themselves
+        if (!loops_ready_)
+            return;
+        for (auto &l : loops_)
+        {
+            uint64_t one = 1;
+            if (::write(l->wake_fd, &one, sizeof(one)) < 0)
+                continue;
+        }
+    }
+
+    void stop_epoll()
+    {
+        stop_ = true;
+        svr_sock_ = INVALID_SOCKET;
+        if (listen_fd_ >= 0 && !released_)
+            ::shutdown(listen_fd_, SHUT_RDWR);
+        for (auto &l : loops_)
+        {
+            uint64_t one = 1;
+            if (::write(l->wake_fd, &one, sizeof(one)) < 0)
+                continue;
+        }
+    }
+
+    size_t connections() const { return open_.load(std::memory_order_relaxed); }
+    // requests wait for an execution slot at dispatch (epoll front end) or
+    // in the handler (threads front end)
+    void set_admission(Admission *a) { admission_ = a; }
+    uint64_t responses() const { return responses_.load(std::memory_order_relaxed); }
+    uint64_t pipelined() const { return pipelined_.load(std::memory_order_relaxed); }
+    uint64_t response_writes() const { return writes_.load(std::memory_order_relaxed); }
+
+    // runs the accept and I/O loops on the sockets from bind_epoll and
+    // bind_unix until stop_epoll()
+    bool serve_epoll(int io_threads) { return (listen_fd_ >= 0 || unix_fd_ >= 0) && serve_epoll_impl(io_threads); }
+
+    // serves the same routes on a Unix socket, next to the TCP port or on its
+    // own. The socket file is created with `mode` (and `group`, if given) so
+    // only local users allowed by the file system can connect; a stale file
+    // from an earlier run is replaced.
+    bool bind_unix(const std::string &path, mode_t mode, const std::string &group)
+    {
+        gid_t gid = (gid_t)-1;
+        if (!group.empty())
+        {
+            struct group *g = getgrnam(group.c_str());
+            if (!g)
+            {
+                std::cerr << "[UNIX] no such group: " << group << "\n";
+                return false;
+            }
+            gid = g->gr_gid;
+        }
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        unix_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ::unlink(path.c_str());
+        // bind() creates the file; the umask keeps it from ever being wider than `mode`
+        mode_t old_mask = ::umask(0777 & ~mode);
+        bool ok = unix_fd_ >= 0 && ::bind(unix_fd_, (sockaddr *)&addr, sizeof(addr)) == 0;
+        ::umask(old_mask);
+        struct stat st{};
+        ok = ok && ::chmod(path.c_str(), mode) == 0 && (gid == (gid_t)-1 || ::chown(path.c_str(), (uid_t)-1, gid) == 0) &&
+             ::stat(path.c_str(), &st) == 0 && ::listen(unix_fd_, 4096) == 0;
+        if (!ok)
+        {
+            std::cerr << "[UNIX] cannot listen on " << path << ": " << std::strerror(errno) << "\n";
+            if (unix_fd_ >= 0)
+                ::close(unix_fd_);
+            unix_fd_ = -1;
+            return false;
+        }
+        unix_path_ = path;
+        unix_ino_ = st.st_ino;
+        return true;
+    }
+
+    // the threads front end: httplib's listen_after_bind(), with a second
+    // accept thread feeding Unix socket connections to their own pool
+    bool serve_threads()
+    {
+        if (unix_fd_ < 0)
+            return listen_after_bind();
+        bool ok;
+        stop_ = false;
+        if (svr_sock_ == INVALID_SOCKET)
+        {
+            // Unix socket only; the listener is non-blocking, so httplib must poll
+            set_idle_interval(0, 100000);
+            svr_sock_ = ::dup(unix_fd_); // stop() closes it; close_unix() the original
+            ok = listen_after_bind();
+        }
+        else
+        {
+            std::unique_ptr<httplib::TaskQueue> pool(new_task_queue());
+            std::thread unix_accept([&]
+                                    { accept_loop(unix_fd_, [&](int fd, const sockaddr_storage &)
+                                                  {
+                // httplib's connection loop expects blocking sockets with timeouts
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+                httplib::detail::set_socket_opt_time(fd, SOL_SOCKET, SO_RCVTIMEO, read_timeout_sec_, read_timeout_usec_);
+                httplib::detail::set_socket_opt_time(fd, SOL_SOCKET, SO_SNDTIMEO, write_timeout_sec_, write_timeout_usec_);
+                if (!pool->enqueue([this, fd] { process_and_close_socket(fd); }))
+                    ::close(fd); }); });
+            ok = listen_after_bind();
+            stop_ = true;
+            unix_accept.join();
+            pool->shutdown();
+        }
+        close_unix();
+        return ok;
+    }
+
+protected:
+    struct Loop;
+
+    struct Conn
+    {
+        int fd = -1;
+        uint64_t key = 0;
+        Loop *loop = nullptr;
+        std::string in;
+        std::string remote_ip, local_ip;
+        int remote_port = 0, local_port = 0;
+        bool busy = false, peer_closed = false;
+        std::chrono::steady_clock::time_point last;
+        std::mutex mu;
+    };
+
+    struct Loop
+    {
+        int epfd = -1, wake_fd = -1;
+        std::thread thread;
+        std::mutex mu;
+        std::unordered_map<uint64_t, std::shared_ptr<Conn>> conns;
+    };
+
+    // response bytes not yet sent; small writes share a segment, and flush()
+    // hands every segment to one sendmsg
+    class WriteBatch
+    {
+    public:
+        static constexpr size_t kMerge = 16 << 10;
+        static constexpr size_t kLimit = 256 << 10; // sent early beyond this
+
+        explicit WriteBatch(std::atomic<uint64_t> &writes) : writes_(writes) {}
+        bool empty() const { return bytes_ == 0; }
+        size_t bytes() const { return bytes_; }
+
+        void add(const char *p, size_t n)
+        {
+            if (!segs_.empty() && segs_.back().size() + n <= kMerge)
+                segs_.back().append(p, n);
+            else
+                segs_.emplace_back(p, n);
+            bytes_ += n;
+        }
+
+        // MSG_DONTWAIT so blocking sockets (threads front end) also wait for
+        // writability with a timeout instead of inside the kernel
+        bool flush(int fd, int timeout_ms)
+        {
+            size_t first = 0, off = 0; // first unsent segment and bytes of it already sent
+            while (first < segs_.size())
+            {
+                iovec iov[64];
+                size_t n = 0;
+                for (size_t i = first; i < segs_.size() && n < 64; ++i, ++n)
+                {
+                    iov[n].iov_base = (void *)(segs_[i].data() + (i == first ? off : 0));
+                    iov[n].iov_len = segs_[i].size() - (i == first ? off : 0);
+                }
+                msghdr msg{};
+                msg.msg_iov = iov;
+                msg.msg_iovlen = n;
+                ssize_t w = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (w >= 0)
+                    writes_.fetch_add(1, std::memory_order_relaxed);
+                else if (errno == EINTR)
+                    continue;
+                else
+                {
+                    pollfd pfd{fd, POLLOUT, 0};
+                    if ((errno == EAGAIN || errno == EWOULDBLOCK) && ::poll(&pfd, 1, timeout_ms) > 0)
+                        continue;
+                    segs_.clear();
+                    bytes_ = 0;
+                    return false;
+                }
+                for (size_t left = (size_t)w; left > 0;)
+                {
+                    size_t in_seg = segs_[first].size() - off;
+                    size_t k = std::min(left, in_seg);
+                    off += k;
+                    left -= k;
+                    if (off == segs_[first].size())
+                    {
+                        ++first;
+                        off = 0;
+                    }
+                }
+            }
+            segs_.clear();
+            bytes_ = 0;
+            return true;
+        }
+
+    private:
+        std::vector<std::string> segs_;
+        size_t bytes_ = 0;
+        std::atomic<uint64_t> &writes_;
+    };
+
+    // writes go to a WriteBatch, sent when the owner calls flush(), when it
+    // grows past kLimit, or when a streamed response asks for writability
+    // before producing its next chunk
+    class BatchedStream : public httplib::Stream
+    {
+    public:
+        BatchedStream(int fd, int write_timeout_ms, std::atomic<uint64_t> &writes) : fd_(fd), timeout_ms_(write_timeout_ms), out_(writes) {}
+        bool wait_writable() const override { return flush(); }
+        ssize_t write(const char *ptr, size_t size) override
+        {
+            if (failed_)
+                return -1;
+            out_.add(ptr, size);
+            if (out_.bytes() >= WriteBatch::kLimit && !flush())
+                return -1;
+            return (ssize_t)size;
+        }
+        socket_t socket() const override { return fd_; }
+        time_t duration() const override { return 0; }
+        bool flush() const
+        {
+            if (!failed_ && !out_.empty() && !out_.flush(fd_, timeout_ms_))
+                failed_ = true;
+            return !failed_;
+        }
+        bool failed() const { return failed_; }
+
+    protected:
+        int fd_;
+        int timeout_ms_;
+        mutable WriteBatch out_;
+        mutable bool failed_ = false;
+    };
+
+    // the bytes of one or more complete buffered requests, and the live
+    // socket for the responses
+    class ConnStream : public BatchedStream
+    {
+    public:
+        ConnStream(const std::string &req, Conn &c, int write_timeout_ms, std::atomic<uint64_t> &writes)
+            : BatchedStream(c.fd, write_timeout_ms, writes), req_(req), c_(c) {}
+        bool is_readable() const override { return pos_ < req_.size(); }
+        bool wait_readable() const override { return is_readable(); }
+        ssize_t read(char *ptr, size_t size) override
+        {
+            size_t n = std::min(size, req_.size() - pos_);
+            std::memcpy(ptr, req_.data() + pos_, n);
+            pos_ += n;
+            return (ssize_t)n;
+        }
+        void get_remote_ip_and_port(std::string &ip, int &port) const override
+        {
+            ip = c_.remote_ip;
+            port = c_.remote_port;
+        }
+        void get_local_ip_and_port(std::string &ip, int &port) const override
+        {
+            ip = c_.local_ip;
+            port = c_.local_port;
+        }
+
+    private:
+        const std::string &req_;
+        size_t pos_ = 0;
+        Conn &c_;
+    };
+
+    // httplib's SocketStream lives for one request and drops whatever it read
+    // past that request, which loses pipelined requests; this one lives for
+    // the connection, so read-ahead carries over to the next request
+    class KeepAliveStream : public BatchedStream
+    {
+    public:
+        KeepAliveStream(socket_t sock, time_t read_sec, time_t read_usec, int write_timeout_ms, std::atomic<uint64_t> &writes)
+            : BatchedStream(sock, write_timeout_ms, writes), read_sec_(read_sec), read_usec_(read_usec) {}
+        bool is_readable() const override { return pos_ < len_; }
+        bool wait_readable() const override { return is_readable() || httplib::detail::select_read(fd_, read_sec_, read_usec_) > 0; }
+        // as SocketStream's, which is how a streamed response notices the client left
+        bool wait_writable() const override
+        {
+            return flush() && httplib::detail::select_write(fd_, timeout_ms_ / 1000, (timeout_ms_ % 1000) * 1000) > 0 &&
+                   httplib::detail::is_socket_alive(fd_);
+        }
+        ssize_t read(char *ptr, size_t size) override
+        {
+            if (pos_ == len_)
+            {
+                // the client may be waiting for these (100 Continue) before it sends more
+                if (!flush() || !wait_readable())
+                    return -1;
+                ssize_t r = httplib::detail::read_socket(fd_, buf_, sizeof(buf_), 0);
+                if (r <= 0)
+                    return r;
+                pos_ = 0;
+                len_ = (size_t)r;
+            }
+            size_t n = std::min(size, len_ - pos_);
+            std::memcpy(ptr, buf_ + pos_, n);
+            pos_ += n;
+            return (ssize_t)n;
+        }
+        void get_remote_ip_and_port(std::string &ip, int &port) const override { httplib::detail::get_remote_ip_and_port(fd_, ip, port); }
+        void get_local_ip_and_port(std::string &ip, int &port) const override { httplib::detail::get_local_ip_and_port(fd_, ip, port); }
+
+    private:
+        time_t read_sec_, read_usec_;
+        char buf_[16384];
+        size_t pos_ = 0, len_ = 0;
+    };
+
+    // bytes in the first complete request of `in`, 0 if it is incomplete,
+    // npos if it can never be parsed
+    static size_t request_length(std::string_view in)
+    {
+        size_t hdr_end = in.find("\r\n\r\n");
+        if (hdr_end == std::string::npos)
+            return in.size() > kMaxHeader ? std::string::npos : 0;
+        size_t body = hdr_end + 4, content_length = 0;
+        bool chunked = false;
+        for (size_t line = in.find("\r\n") + 2; line < hdr_end + 2;)
+        {
+            size_t eol = in.find("\r\n", line);
+            const char *h = in.data() + line;
+            size_t len = eol - line;
+            if (len > 15 && strncasecmp(h, "content-length:", 15) == 0)
+                content_length = std::strtoull(h + 15, nullptr, 10);
+            else if (len > 18 && strncasecmp(h, "transfer-encoding:", 18) == 0 && std::string(h + 18, len - 18).find("chunked") != std::string::npos)
+                chunked = true;
+            line = eol + 2;
+        }
+        if (chunked)
+        {
+            // no trailers: the body ends with the zero-size chunk
+            if (in.compare(body, 5, "0\r\n\r\n") == 0)
+                return body + 5;
+            size_t end = in.find("\r\n0\r\n\r\n", body);
+            return end == std::string::npos ? 0 : end + 7;
+        }
+        if (content_length > kMaxBuffered)
+            return std::string::npos;
+        return in.size() >= body + content_length ? body + content_length : 0;
+    }
+
+    bool serve_epoll_impl(int io_threads)
+    {
+        stop_ = false;
+        // httplib's streaming writers stop once svr_sock_ is invalid
+        svr_sock_ = listen_fd_ >= 0 ? listen_fd_ : unix_fd_;
+        task_queue_.reset(new_task_queue());
+        for (int i = 0; i < std::max(1, io_threads); ++i)
+        {
+            auto l = std::make_unique<Loop>();
+            l->epfd = epoll_create1(EPOLL_CLOEXEC);
+            l->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = 0;
+            epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->wake_fd, &ev);
+            loops_.push_back(std::move(l));
+        }
+        loops_ready_ = true; // before any loop runs: see release_listener()
+        for (auto &l : loops_)
+        {
+            Loop *lp = l.get();
+            lp->thread = std::thread([this, lp]
+                                     { run_loop(*lp); });
+        }
+
+        auto take = [this](int fd, const sockaddr_storage &peer)
+        { add_conn(fd, peer); };
+        std::thread unix_accept;
+        if (listen_fd_ >= 0 && unix_fd_ >= 0)
+            unix_accept = std::thread([this, &take]
+                                      { accept_loop(unix_fd_, take); });
+        accept_loop(listen_fd_ >= 0 ? listen_fd_ : unix_fd_, take);
+        if (unix_accept.joinable())
+            unix_accept.join();
+
+        // released: the loops keep serving until every connection is closed
+        auto drain_until = std::chrono::steady_clock::now() + std::chrono::seconds(keep_alive_timeout_sec_);
+        while (!stop_ && open_.load() > 0 && std::chrono::steady_clock::now() < drain_until)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        stop_epoll();
+        for (auto &l : loops_)
+            l->thread.join();
+        task_queue_->shutdown();
+        for (auto &l : loops_)
+        {
+            for (auto &kv : l->conns)
+                ::close(kv.second->fd);
+            ::close(l->epfd);
+            ::close(l->wake_fd);
+        }
+        loops_ready_ = false;
+        loops_.clear();
+        if (!released_ && listen_fd_ >= 0)
+            ::close(listen_fd_); // a released one stays open until exit
+        listen_fd_ = -1;
+        close_unix();
+        return true;
+    }
+
+    // accepts from a non-blocking listener until stop_epoll() or, for TCP,
+    // release_listener(). After a release the Unix socket's queue is still
+    // emptied: its path already leads to the successor, so nothing new
+    // arrives and whatever is queued would otherwise be reset at exit.
+    void accept_loop(int lfd, const std::function<void(int, const sockaddr_storage &)> &take)
+    {
+        while (!stop_ && !(released_ && lfd != unix_fd_))
+        {
+            sockaddr_storage peer{};
+            socklen_t plen = sizeof(peer);
+            int fd = ::accept4(lfd, (sockaddr *)&peer, &plen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                // the listener is non-blocking so a handed-off socket can be
+                // released without shutdown(); wait here instead
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (released_)
+                        return;
+                    pollfd p{lfd, POLLIN, 0};
+                    ::poll(&p, 1, 100);
+                    continue;
+                }
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno == EMFILE || errno == ENFILE)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+                return;
+            }
+            take(fd, peer);
+        }
+    }
+
+    void add_conn(int fd, const sockaddr_storage &peer)
+    {
+        if (peer.ss_family != AF_UNIX)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        auto c = std::make_shared<Conn>();
+        c->fd = fd;
+        c->key = ((uint64_t)next_gen_++ << 32) | (uint32_t)fd;
+        c->loop = loops_[rr_++ % loops_.size()].get();
+        c->last = std::chrono::steady_clock::now();
+        char ip[INET6_ADDRSTRLEN] = "";
+        if (peer.ss_family == AF_INET)
+        {
+            auto *a = (sockaddr_in *)&peer;
+            inet_ntop(AF_INET, &a->sin_addr, ip, sizeof(ip));
+            c->remote_port = ntohs(a->sin_port);
+        }
+        c->remote_ip = ip;
+        httplib::detail::get_local_ip_and_port(fd, c->local_ip, c->local_port);
+        {
+            std::lock_guard<std::mutex> lk(c->loop->mu);
+            c->loop->conns[c->key] = c;
+        }
+        open_.fetch_add(1, std::memory_order_relaxed);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = c->key;
+        epoll_ctl(c->loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void close_unix()
+    {
+        if (unix_fd_ < 0)
+            return;
+        ::close(unix_fd_);
+        // leave the path alone if a successor has rebound it
+        struct stat now{};
+        if (stat(unix_path_.c_str(), &now) == 0 && now.st_ino == unix_ino_)
+            ::unlink(unix_path_.c_str());
+        unix_fd_ = -1;
+    }
+
+    void run_loop(Loop &l)
+    {
+        epoll_event evs[256];
+        auto last_sweep = std::chrono::steady_clock::now();
+        while (!stop_)
+        {
+            // queued requests are expired at most 50 ms late
+            int n = epoll_wait(l.epfd, evs, 256, released_ ? 10 : admission_ ? 50 : 1000);
+            for (int i = 0; i < n; ++i)
+            {
+                if (evs[i].data.u64 == 0)
+                {
+                    uint64_t v;
+                    while (::read(l.wake_fd, &v, sizeof(v)) > 0)
+                        ;
+                    continue;
+                }
+                std::shared_ptr<Conn> c;
+                {
+                    std::lock_guard<std::mutex> lk(l.mu);
+                    auto it = l.conns.find(evs[i].data.u64);
+                    if (it != l.conns.end())
+                        c = it->second;
+                }
+                if (c)
+                    on_readable(c);
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (admission_)
+                admission_->expire();
+            if (now - last_sweep >= (released_ ? std::chrono::milliseconds(10) : std::chrono::milliseconds(1000)))
+            {
+                last_sweep = now;
+                sweep_idle(l, now);
+            }
+        }
+    }
+
+    void on_readable(const std::shared_ptr<Conn> &c)
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        if (c->fd < 0)
+            return;
+        char buf[65536];
+        while (true)
+        {
+            ssize_t r = ::recv(c->fd, buf, sizeof(buf), 0);
+            if (r > 0)
+            {
+                c->in.append(buf, (size_t)r);
+                continue;
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                c->peer_closed = true;
+            break;
+        }
+        c->last = std::chrono::steady_clock::now();
+        if (c->in.size() > kMaxBuffered)
+            c->peer_closed = true;
+        if (!c->busy)
+            dispatch_locked(c);
+    }
+
+    // admission class of the complete request at the start of `in`, and its
+    // X-Request-Timeout-Ms value
+    static Admission::Class request_class(std::string_view in, std::string_view *timeout = nullptr)
+    {
+        size_t eol = in.find("\r\n"), sp1 = in.find(' '), sp2 = in.find(' ', sp1 + 1);
+        if (sp1 >= eol || sp2 >= eol)
+            return Admission::Reads; // httplib answers the malformed line
+        std::string_view path = in.substr(sp1 + 1, sp2 - sp1 - 1);
+        path = path.substr(0, path.find('?'));
+        size_t hdr_end = in.find("\r\n\r\n");
+        for (size_t line = eol + 2; timeout && line < hdr_end + 2;)
+        {
+            size_t next = in.find("\r\n", line);
+            std::string_view h = in.substr(line, next - line);
+            if (h.size() > 21 && strncasecmp(h.data(), "x-request-timeout-ms:", 21) == 0)
+            {
+                *timeout = h.substr(21);
+                while (!timeout->empty() && timeout->front() == ' ')
+                    timeout->remove_prefix(1);
+            }
+            line = next + 2;
+        }
+        return Admission::classify(in.substr(0, sp1), path);
+    }
+
+    // one refusal per request of a batch admission turned away; the
+    // connection stays open
+    void refuse_locked(const std::shared_ptr<Conn> &c, Admission::Verdict v, size_t count)
+    {
+        int status;
+        std::string body = std::string(R"({"status":"error","reason":")") + Admission::refusal(v, status) + "\"}";
+        std::string one = "HTTP/1.1 " + std::to_string(status) + " " + httplib::status_message(status) +
+                          "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                          (status == 503 ? "\r\nRetry-After: 1" : "") + "\r\n\r\n" + body;
+        WriteBatch out(writes_);
+        for (size_t i = 0; i < count; ++i)
+            out.add(one.data(), one.size());
+        if (!out.flush(c->fd, write_timeout_ms()))
+            c->peer_closed = true;
+        responses_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // starts the next buffered request, or closes the connection when there
+    // is nothing left to do on it; c->mu is held. With admission control the
+    // request (and the pipelined ones of the same class behind it) waits for
+    // an execution slot before it takes a worker thread.
+    void dispatch_locked(const std::shared_ptr<Conn> &c)
+    {
+        while (true)
+        {
+            size_t n = request_length(c->in);
+            if (n == std::string::npos)
+            {
+                static const char bad[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                ssize_t w = ::send(c->fd, bad, sizeof(bad) - 1, MSG_NOSIGNAL);
+                (void)w;
+                close_locked(c);
+                return;
+            }
+            if (n == 0)
+            {
+                if (c->peer_closed || stop_)
+                    close_locked(c);
+                return;
+            }
+            auto received = std::chrono::steady_clock::now();
+            Admission::Class cls = Admission::Exempt;
+            Admission::Clock::time_point deadline;
+            if (admission_)
+            {
+                std::string_view timeout;
+                cls = request_class(c->in, &timeout);
+                deadline = admission_->deadline(timeout, received);
+            }
+            // pipelined requests behind it go to the same task
+            size_t count = 1;
+            for (; count < kMaxPipelined && n < c->in.size(); ++count)
+            {
+                std::string_view rest = std::string_view(c->in).substr(n);
+                size_t k = request_length(rest);
+                if (k == 0 || k == std::string::npos || (admission_ && request_class(rest) != cls))
+                    break;
+                n += k;
+            }
+            auto req = std::make_shared<std::string>(c->in, 0, n);
+            c->in.erase(0, n);
+            Admission::Verdict v = Admission::Verdict::Run;
+            if (cls != Admission::Exempt)
+                v = admission_->submit(cls, deadline, [this, c, req, cls, received, count](Admission::Verdict v)
+                                       { granted(c, req, cls, received, count, v); });
+            if (v == Admission::Verdict::Overloaded || v == Admission::Verdict::Expired)
+            {
+                refuse_locked(c, v, count);
+                continue;
+            }
+            c->busy = true;
+            if (v == Admission::Verdict::Run && !start(c, req, cls, received))
+            {
+                c->busy = false;
+                refuse_closing_locked(c);
+            }
+            return;
+        }
+    }
+
+    bool start(const std::shared_ptr<Conn> &c, const std::shared_ptr<std::string> &req, Admission::Class cls, Admission::Clock::time_point received)
+    {
+        if (task_queue_->enqueue([this, c, req, cls, received]
+                                 { serve(c, *req, cls, received); }))
+            return true;
+        if (cls != Admission::Exempt)
+            admission_->finish(cls);
+        return false;
+    }
+
+    // a queued request's turn came, or its deadline passed, on some other
+    // thread; c->mu is not held
+    void granted(const std::shared_ptr<Conn> &c, const std::shared_ptr<std::string> &req, Admission::Class cls,
+                 Admission::Clock::time_point received, size_t count, Admission::Verdict v)
+    {
+        if (v == Admission::Verdict::Run && start(c, req, cls, received))
+            return;
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->busy = false;
+        if (v == Admission::Verdict::Run)
+            refuse_closing_locked(c);
+        else
+        {
+            refuse_locked(c, v, count);
+            c->last = std::chrono::steady_clock::now();
+            dispatch_locked(c);
+        }
+    }
+
+    // the worker pool has shut down
+    void refuse_closing_locked(const std::shared_ptr<Conn> &c)
+    {
+        static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        ssize_t w = ::send(c->fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+        (void)w;
+        close_locked(c);
+    }
+
+    int write_timeout_ms() const { return (int)(write_timeout_sec_ * 1000 + write_timeout_usec_ / 1000); }
+
+    // answers the requests in `req` in order and sends the responses together;
+    // requests after one that closes the connection are dropped unanswered,
+    // which HTTP/1.1 pipelining clients have to expect anyway
+    void serve(const std::shared_ptr<Conn> &c, const std::string &req, Admission::Class cls, Admission::Clock::time_point received)
+    {
+        // timed() checks each request's deadline but does not queue it again
+        t_admitted = admission_ != nullptr;
+        t_received = received;
+        t_client_fd = c->fd;
+        ConnStream strm(req, *c, write_timeout_ms(), writes_);
+        bool ok, closed = false, closing; // what the last response announced
+        uint64_t served = 0;
+        do
+        {
+            closing = released_;
+            ok = process_request(strm, c->remote_ip, c->remote_port, c->local_ip, c->local_port, closing, closed, nullptr);
+            ++served;
+        } while (ok && !closed && !closing && !strm.failed() && strm.is_readable());
+        bool sent = strm.flush();
+        t_admitted = false;
+        t_client_fd = -1;
+        if (cls != Admission::Exempt)
+            admission_->finish(cls);
+        responses_.fetch_add(served, std::memory_order_relaxed);
+        pipelined_.fetch_add(served - 1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->busy = false;
+        c->last = std::chrono::steady_clock::now();
+        if (!ok || closed || closing || !sent)
+            close_locked(c);
+        else
+            dispatch_locked(c);
+    }
+
+    // httplib's thread-per-connection loop, except that once the listener is
+    // released every response carries Connection: close, so busy keep-alive
+    // clients move to the successor instead of keeping this process alive.
+    // A request already read ahead is served without waiting; responses are
+    // sent only before the connection waits for the client again.
+    bool process_and_close_socket(socket_t sock) override
+    {
+        std::string remote_addr, local_addr;
+        int remote_port = 0, local_port = 0;
+        httplib::detail::get_remote_ip_and_port(sock, remote_addr, remote_port);
+        httplib::detail::get_local_ip_and_port(sock, local_addr, local_port);
+        KeepAliveStream strm(sock, read_timeout_sec_, read_timeout_usec_, write_timeout_ms(), writes_);
+        bool ret = false;
+        t_client_fd = sock;
+        for (size_t count = keep_alive_max_count_; count > 0; --count)
+        {
+            bool pipelined = strm.is_readable();
+            if (!pipelined && !(strm.flush() && httplib::detail::keep_alive(svr_sock_, sock, keep_alive_timeout_sec_)))
+                break;
+            bool closed = false;
+            ret = process_request(strm, remote_addr, remote_port, local_addr, local_port, count == 1 || released_, closed, nullptr);
+            responses_.fetch_add(1, std::memory_order_relaxed);
+            if (pipelined)
+                pipelined_.fetch_add(1, std::memory_order_relaxed);
+            if (!ret || closed)
+                break;
+        }
+        strm.flush();
+        t_client_fd = -1;
+        httplib::detail::shutdown_socket(sock);
+        httplib::detail::close_socket(sock);
+        return ret;
+    }
+
+    void close_locked(const std::shared_ptr<Conn> &c)
+    {
+        if (c->fd < 0)
+            return;
+        epoll_ctl(c->loop->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+        ::close(c->fd);
+        c->fd = -1;
+        open_.fetch_sub(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(c->loop->mu);
+        c->loop->conns.erase(c->key);
+    }
+
+    // idle keep-alive connections are closed after keep_alive_timeout_sec_,
+    // as httplib does for its own
+    void sweep_idle(Loop &l, std::chrono::steady_clock::time_point now)
+    {
+        std::vector<std::shared_ptr<Conn>> all;
+        {
+            std::lock_guard<std::mutex> lk(l.mu);
+            all.reserve(l.conns.size());
+            for (auto &kv : l.conns)
+                all.push_back(kv.second);
+        }
+        // while draining, as soon as nothing is pending, like httplib's own
+        // keep-alive check
+        auto idle = released_ ? std::chrono::milliseconds(10) : std::chrono::milliseconds(keep_alive_timeout_sec_ * 1000);
+        for (auto &c : all)
+        {
+            std::lock_guard<std::mutex> lk(c->mu);
+            char peek;
+            if (!c->busy && (!released_ || c->in.empty()) && now - c->last > idle &&
+                (!released_ || ::recv(c->fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) < 0))
+                close_locked(c);
+        }
+    }
+
+    int listen_fd_ = -1;
+    std::atomic<bool> released_{false};
+    std::atomic<bool> loops_ready_{false};
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> open_{0};
+    std::atomic<uint64_t> responses_{0}, pipelined_{0}, writes_{0};
+    Admission *admission_ = nullptr;
+    std::atomic<uint32_t> next_gen_{1};
+    std::atomic<size_t> rr_{0};
+    int unix_fd_ = -1;
+    std::string unix_path_;
+    ino_t unix_ino_ = 0;
+    std::unique_ptr<httplib::TaskQueue> task_queue_;
+    std::vector<std::unique_ptr<Loop>> loops_;
+};
+
+// --- hot restart
+// With MINIBANK_HANDOFF_SOCKET set, a running server waits on that Unix
+// socket for its replacement. A new server started with the same setting
+// connects there before binding anything:
+//   old -> new  the listening socket (SCM_RIGHTS); the port never closes and
+//               connections queued in it stay queued
+//   new -> old  'R' once it holds a usable listener
+//   old         stops accepting, drains in-flight requests, flushes the audit
+//               log and capture, and exits; the new one sees EOF
+//   new         applies whatever the old one committed since its own startup
+//               load, then accepts. Clients wait in the backlog meanwhile.
+// Accepting only after the old process is gone keeps one writer at a time
+// and keeps the new process's caches exact.
+class Handoff
+{
+public:
+    explicit Handoff(std::string path) : path_(std::move(path)) {}
+
+    bool enabled() const { return !path_.empty(); }
+
+    // new process: returns the predecessor's listener, or -1 if none answered
+    int take_over()
+    {
+        if (!enabled())
+            return -1;
+        int c = connect_path();
+        if (c < 0)
+            return -1;
+        int fd = recv_fd(c);
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        if (fd < 0 || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening || ::write(c, "R", 1) != 1)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            ::close(c);
+            return -1;
+        }
+        predecessor_ = c;
+        return fd;
+    }
+
+    // new process: blocks until the predecessor has exited; false on timeout
+    bool wait_predecessor(int timeout_ms)
+    {
+        if (predecessor_ < 0)
+            return true;
+        pollfd p{predecessor_, POLLIN, 0};
+        int n;
+        while ((n = ::poll(&p, 1, timeout_ms)) < 0 && errno == EINTR)
+            ;
+        ::close(predecessor_);
+        predecessor_ = -1;
+        return n > 0;
+    }
+
+    // any process: offers `server`'s listener to the next one to connect.
+    // The first successor that confirms gets it and `server` is released.
+    bool start(EpollServer &server)
+    {
+        if (!enabled())
+            return true;
+        ::unlink(path_.c_str());
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        if (listen_fd_ < 0 || ::bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listen_fd_, 4) < 0)
+        {
+            std::cerr << "[HANDOFF] cannot listen on " << path_ << ": " << std::strerror(errno) << "\n";
+            if (listen_fd_ >= 0)
+                ::close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+        chmod(path_.c_str(), 0600);
+        stat(path_.c_str(), &mine_);
+        thread_ = std::thread([this, &server]
+                              { serve(server); });
+        return true;
+    }
+
+    void stop()
+    {
+        if (listen_fd_ < 0)
+            return;
+        ::shutdown(listen_fd_, SHUT_RDWR);
+        thread_.join();
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        // leave the path alone if the successor has rebound it
+        struct stat now{};
+        if (stat(path_.c_str(), &now) == 0 && now.st_ino == mine_.st_ino)
+            ::unlink(path_.c_str());
+    }
+
+    ~Handoff() { stop(); }
+
+private:
+    void serve(EpollServer &server)
+    {
+        for (;;)
+        {
+            int c = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+            // a successor that never confirms must not stall us for good
+            timeval tv{30, 0};
+            setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            int lfd = server.listener();
+            // both processes accept from this socket until we let go; neither
+            // may block in accept() on a connection the other one took
+            fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+            char ok = 0;
+            if (lfd < 0 || !send_fd(c, lfd) || ::read(c, &ok, 1) != 1 || ok != 'R')
+            {
+                std::cerr << "[HANDOFF] successor did not take the listener\n";
+                ::close(c);
+                continue;
+            }
+            std::cerr << "[HANDOFF] listener handed over, draining\n";
+            // `c` stays open until exit, which is how the successor learns we are done
+            server.release_listener();
+            return;
+        }
+    }
+
+    int connect_path() const
+    {
+        int c = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        if (c >= 0 && ::connect(c, (sockaddr *)&addr, sizeof(addr)) == 0)
+            return c;
+        if (c >= 0)
+            ::close(c);
+        return -1;
+    }
+
+    static bool send_fd(int sock, int fd)
+    {
+        char byte = 'L', ctl[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov{&byte, 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+        return ::sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+    }
+
+    static int recv_fd(int sock)
+    {
+        char byte = 0, ctl[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov{&byte, 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl;
+        msg.msg_controllen = sizeof(ctl);
+        if (::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+            return -1;
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            return -1;
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+        return fd;
+    }
+
+    std::string path_;
+    int listen_fd_ = -1;
+    int predecessor_ = -1;
+    struct stat mine_{};
+    std::thread thread_;
+};
+
+// --- binary RPC
+// The frame codec (RpcCall, RpcReply, rpc_take_call, rpc_put_reply) is in
+// minibank.h, shared with rpcbench.cpp.
+// A thread per connection: internal callers hold a few long-lived ones. Each
+// read takes every whole frame the socket had buffered and hands them to the
+// executor as one batch, and the batch's replies go back in one send, so a
+// pipelining client pays the syscalls (and, via the executor, the commit) once
+// per batch rather than once per request.
+class RpcServer
+{
+public:
+    using Executor = std::function<void(const std::vector<RpcCall> &, std::vector<RpcReply> &)>;
+
+    explicit RpcServer(Metrics &m) : metrics_(m)
+    {
+        static const char *ops[] = {"deposit", "withdraw", "transfer", "balance"};
+        for (int i = 0; i < 4; ++i)
+            op_slots_[i] = m.counter("minibank_rpc_requests_total", "Binary RPC requests by operation.", std::string("op=\"") + ops[i] + "\"");
+        malformed_ = m.counter("minibank_rpc_malformed_total", "Binary RPC frames that could not be decoded.");
+        batch_hist_ = m.histogram("minibank_rpc_batch_duration_seconds", "Wall time to execute one batch of pipelined RPC requests.");
+        m.gauge("minibank_rpc_connections", "Open binary RPC connections.", [this] { return (double)open_.load(); });
+    }
+
+    ~RpcServer() { stop(); }
+
+    bool listen(const std::string &host, int port)
+    {
+        addrinfo hints{}, *ai = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &ai) != 0)
+            return false;
+        for (addrinfo *a = ai; a && fd_ < 0; a = a->ai_next)
+        {
+            int fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            if (fd < 0)
+                continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            // a hot-restarted successor binds while this process drains
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && ::listen(fd, 4096) == 0)
+                fd_ = fd;
+            else
+                close(fd);
+        }
+        freeaddrinfo(ai);
+        return fd_ >= 0;
+    }
+
+    void start(Executor exec)
+    {
+        exec_ = std::move(exec);
+        acceptor_ = std::thread([this]
+                                {
+            for (;;)
+            {
+                int c = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+                if (c < 0)
+                {
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    break; // stop() shut the listener down
+                }
+                int one = 1;
+                setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                std::lock_guard<std::mutex> lk(mu_);
+                if (stopping_)
+                {
+                    close(c);
+                    break;
+                }
+                reap();
+                conns_.emplace_back();
+                Conn &conn = conns_.back();
+                conn.fd = c;
+                conn.thread = std::thread([this, &conn] { serve(conn); });
+            } });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (stopping_ || fd_ < 0)
+                return;
+            stopping_ = true;
+            shutdown(fd_, SHUT_RDWR);
+            // read side only: a batch already running still gets its replies out
+            for (Conn &c : conns_)
+                if (!c.done)
+                    shutdown(c.fd, SHUT_RD);
+        }
+        acceptor_.join();
+        for (Conn &c : conns_)
+            c.thread.join();
+        conns_.clear();
+        close(fd_);
+    }
+
+private:
+    struct Conn
+    {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    // join finished connections; caller holds mu_
+    void reap()
+    {
+        for (auto it = conns_.begin(); it != conns_.end();)
+        {
+            if (it->done)
+            {
+                it->thread.join();
+                it = conns_.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    void serve(Conn &conn)
+    {
+        open_.fetch_add(1);
+        std::string in, out;
+        std::vector<RpcCall> calls;
+        std::vector<RpcReply> replies;
+        char buf[65536];
+        bool ok = true;
+        while (ok)
+        {
+            ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+            if (n <= 0)
+                break;
+            in.append(buf, (size_t)n);
+            calls.clear();
+            size_t at = 0, len;
+            while ((len = rpc_frame(in, at)) != 0)
+            {
+                if (len == SIZE_MAX)
+                {
+                    // no way to find the next frame boundary
+                    metrics_.inc(malformed_);
+                    ok = false;
+                    break;
+                }
+                calls.emplace_back();
+                if (!rpc_take_call(in.data() + at + 4, len - 4, calls.back()))
+                {
+                    metrics_.inc(malformed_);
+                    calls.back().op = 0;
+                }
+                else
+                    metrics_.inc(op_slots_[calls.back().op - 1]);
+                at += len;
+            }
+            in.erase(0, at);
+            if (calls.empty())
+                continue;
+            auto t0 = std::chrono::steady_clock::now();
+            replies.assign(calls.size(), RpcReply());
+            exec_(calls, replies);
+            metrics_.observe_since<std::chrono::steady_clock>(batch_hist_, t0);
+            out.clear();
+            for (const RpcReply &r : replies)
+                rpc_put_reply(out, r);
+            for (size_t sent = 0; sent < out.size();)
+            {
+                ssize_t w = send(conn.fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+                if (w <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                sent += (size_t)w;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            close(conn.fd);
+            conn.done = true;
+        }
+        open_.fetch_sub(1);
+    }
 
-// --- time helper
-std::string now_iso()
+    Metrics &metrics_;
+    Executor exec_;
+    int fd_ = -1;
+    std::thread acceptor_;
+    std::list<Conn> conns_;
+    bool stopping_ = false;
+    std::mutex mu_;
+    std::atomic<int> open_{0};
+    size_t op_slots_[4] = {}, malformed_ = 0, batch_hist_ = 0;
+};
+
+// --- multi-process mode
+// MINIBANK_WORKERS=N makes this process a supervisor that forks one writer
+// and N workers. Workers bind the TCP port with SO_REUSEPORT, so the kernel
+// spreads connections over them, and serve GETs from their own connection
+// and caches. Every POST is relayed to the writer over a Unix socket, so one
+// process owns all writes and ledger_mu still serializes money movement.
+// Workers follow the writer by polling transactions and accounts past the
+// last id they have seen (WAL readers never block it) and feed new rows
+// through on_ledger_write, which keeps their caches, ETags, /changes and
+// /stream current. The supervisor restarts children that exit; SIGHUP
+// replaces them one at a time, each new worker bound before the old one
+// drains, while the writer is only replaced once the old one has drained and
+// exited, so there is never more than one; SIGTERM/SIGINT stop everything
+// gracefully.
+struct ProcessRole
 {
-    std::time_t t = std::time(nullptr);
-    char buf[64];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
-    return std::string(buf);
-}
+    enum Kind
+    {
+        Single,
+        Writer,
+        Worker
+    } kind = Single;
+    int ready_fd = -1; // supervisor pipe; one byte once the socket is bound
+    std::string writer_socket;
+};
 
-// --- random hex
-std::string random_hex(int len = 32)
+static const char *role_name(ProcessRole::Kind k)
 {
-    static std::mt19937_64 rng((unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count());
-    static const char *hex = "0123456789abcdef";
-    std::string s;
-    s.reserve(len);
-    for (int i = 0; i < len; ++i)
-        s.push_back(hex[rng() & 0xF]);
-    return s;
+    return k == ProcessRole::Writer ? "writer" : k == ProcessRole::Worker ? "worker" : "server";
 }
 
-// --- small SHA256 (compact) - production: use libsodium/OpenSSL
-typedef unsigned int uint32;
-typedef unsigned long long uint64;
-static inline uint32 rotr(uint32 x, uint32 n) { return (x >> n) | (x << (32 - n)); }
-static inline uint32 ch(uint32 x, uint32 y, uint32 z) { return (x & y) ^ (~x & z); }
-static inline uint32 maj(uint32 x, uint32 y, uint32 z) { return (x & y) ^ (x & z) ^ (y & z); }
-static inline uint32 bsig0(uint32 x) { return rotr(x, 2) ^ rotr(x, 13) ^ rotr(x, 22); }
-static inline uint32 bsig1(uint32 x) { return rotr(x, 6) ^ rotr(x, 11) ^ rotr(x, 25); }
-static inline uint32 ssig0(uint32 x) { return rotr(x, 7) ^ rotr(x, 18) ^ (x >> 3); }
-static inline uint32 ssig1(uint32 x) { return rotr(x, 17) ^ rotr(x, 19) ^ (x >> 10); }
-
-std::string sha256(const std::string &msg)
-{
-    static const uint32 k[64] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76f51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
-
-    uint64 bitlen = (uint64)msg.size() * 8ULL;
-    std::vector<unsigned char> data(msg.begin(), msg.end());
-    data.push_back(0x80);
-    while ((data.size() * 8) % 512 != 448)
-        data.push_back(0x00);
-    for (int i = 7; i >= 0; --i)
-        data.push_back((bitlen >> (i * 8)) & 0xFF);
-
-    uint32 h0 = 0x6a09e667, h1 = 0xbb67ae85, h2 = 0x3c6ef372, h3 = 0xa54ff53a;
-    uint32 h4 = 0x510e527f, h5 = 0x9b05688c, h6 = 0x1f83d9ab, h7 = 0x5be0cd19;
-
-    for (size_t chunk = 0; chunk < data.size(); chunk += 64)
-    {
-        uint32 w[64];
-        memset(w, 0, sizeof(w));
-        for (int i = 0; i < 16; ++i)
-        {
-            w[i] = ((uint32)data[chunk + i * 4] << 24) |
-                   ((uint32)data[chunk + i * 4 + 1] << 16) |
-                   ((uint32)data[chunk + i * 4 + 2] << 8) |
-                   ((uint32)data[chunk + i * 4 + 3]);
-        }
-        for (int i = 16; i < 64; ++i)
-            w[i] = ssig1(w[i - 2]) + w[i - 7] + ssig0(w[i - 15]) + w[i - 16];
-
-        uint32 a = h0, b = h1, c = h2, d = h3, e = h4, f = h5, g = h6, h = h7;
-        for (int i = 0; i < 64; ++i)
-        {
-            uint32 T1 = h + bsig1(e) + ch(e, f, g) + k[i] + w[i];
-            uint32 T2 = bsig0(a) + maj(a, b, c);
-            h = g;
-            g = f;
-            f = e;
-            e = d + T1;
-            d = c;
-            c = b;
-            b = a;
-            a = T1 + T2;
-        }
-        h0 += a;
-        h1 += b;
-        h2 += c;
-        h3 += d;
-        h4 += e;
-        h5 += f;
-        h6 += g;
-        h7 += h;
-    }
-
-    std::ostringstream oss;
-    oss << std::hex << std::setfill('0') << std::nouppercase;
-    auto write32 = [&](uint32 x)
-    { oss << std::setw(8) << x; };
-    write32(h0);
-    write32(h1);
-    write32(h2);
-    write32(h3);
-    write32(h4);
-    write32(h5);
-    write32(h6);
-    write32(h7);
-    return oss.str();
+static void report_ready(ProcessRole &role)
+{
+    if (role.ready_fd < 0)
+        return;
+    char c = 1;
+    ssize_t w = ::write(role.ready_fd, &c, 1);
+    (void)w;
+    ::close(role.ready_fd);
+    role.ready_fd = -1;
 }
 
-// small exec helper (no callback)
-int exec_sql(sqlite3 *db, const char *sql)
+// longest a replaced writer may take over its in-flight requests
+static constexpr std::chrono::seconds kWriterDrain{30};
+
+// returns -1 in a child, which continues into the server with `role` set;
+// in the supervisor, returns the exit code once every child has stopped
+static int run_supervisor(int workers, ProcessRole &role)
 {
-    char *err = nullptr;
-    int rc = sqlite3_exec(db, sql, nullptr, nullptr, &err);
-    if (rc != SQLITE_OK && err)
+    sigset_t sigs, old_mask;
+    sigemptyset(&sigs);
+    for (int sig : {SIGTERM, SIGINT, SIGHUP, SIGCHLD})
+        sigaddset(&sigs, sig);
+    sigprocmask(SIG_BLOCK, &sigs, &old_mask);
+    role.writer_socket = std::getenv("MINIBANK_WRITER_SOCKET") ? std::getenv("MINIBANK_WRITER_SOCKET") : "minibank-writer.sock";
+
+    struct Child
     {
-        std::cerr << "[SQL ERR] " << err << std::endl;
-        sqlite3_free(err);
-    }
-    return rc;
-}
+        pid_t pid;
+        ProcessRole::Kind kind;
+        std::chrono::steady_clock::time_point started;
+    };
+    std::vector<Child> children;
 
-// safe helper to convert possibly-NULL column text to std::string
-static inline std::string to_str(const unsigned char *t)
-{
-    return t ? std::string(reinterpret_cast<const char *>(t)) : std::string("");
+    // forks and waits until the child has bound its socket (or died);
+    // true in the child
+    auto spawn = [&](ProcessRole::Kind kind) -> bool
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            return false;
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            ::close(fds[0]);
+            sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+            role.kind = kind;
+            role.ready_fd = fds[1];
+            return true;
+        }
+        ::close(fds[1]);
+        if (pid < 0)
+        {
+            ::close(fds[0]);
+            std::cerr << "[SUPERVISOR] fork failed: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        char c;
+        ssize_t r;
+        do
+            r = ::read(fds[0], &c, 1);
+        while (r < 0 && errno == EINTR);
+        ::close(fds[0]);
+        children.push_back({pid, kind, std::chrono::steady_clock::now()});
+        if (r != 1)
+            std::cerr << "[SUPERVISOR] " << role_name(kind) << " " << pid << " exited during startup\n";
+        return false;
+    };
+
+    // waits for a stopped writer to exit, killing it if it has not drained
+    // within kWriterDrain
+    auto reap_writer = [](pid_t pid)
+    {
+        auto deadline = std::chrono::steady_clock::now() + kWriterDrain;
+        int status;
+        while (waitpid(pid, &status, WNOHANG) == 0)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                std::cerr << "[SUPERVISOR] writer " << pid << " did not drain, killing it\n";
+                kill(pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    };
+
+    if (spawn(ProcessRole::Writer))
+        return -1;
+    for (int i = 0; i < workers; ++i)
+        if (spawn(ProcessRole::Worker))
+            return -1;
+    std::cout << "[SUPERVISOR] writer on " << role.writer_socket << ", " << workers << " workers on port 8080\n";
+
+    bool stopping = false;
+    while (true)
+    {
+        int sig = 0;
+        sigwait(&sigs, &sig);
+        if (sig == SIGCHLD)
+        {
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                auto it = std::find_if(children.begin(), children.end(), [&](const Child &c)
+                                       { return c.pid == pid; });
+                if (it == children.end())
+                    continue; // replaced by a SIGHUP restart
+                Child gone = *it;
+                children.erase(it);
+                if (stopping)
+                    continue;
+                std::cerr << "[SUPERVISOR] " << role_name(gone.kind) << " " << pid << " exited ("
+                          << (WIFSIGNALED(status) ? "signal " + std::to_string(WTERMSIG(status)) : "status " + std::to_string(WEXITSTATUS(status)))
+                          << "), restarting\n";
+                // a child that cannot start (port taken, bad db) should not spin
+                if (std::chrono::steady_clock::now() - gone.started < std::chrono::seconds(1))
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                if (spawn(gone.kind))
+                    return -1;
+            }
+            if (stopping && children.empty())
+                return 0;
+        }
+        else if (sig == SIGHUP && !stopping)
+        {
+            std::cout << "[SUPERVISOR] rolling restart\n";
+            std::vector<Child> old = children;
+            for (const Child &c : old)
+            {
+                children.erase(std::find_if(children.begin(), children.end(), [&](const Child &x)
+                                            { return x.pid == c.pid; }));
+                if (c.kind == ProcessRole::Writer)
+                {
+                    // two writers would each check balances against their own
+                    // view; the new one starts after the old one has drained,
+                    // and loads everything it committed
+                    kill(c.pid, SIGTERM);
+                    reap_writer(c.pid);
+                    if (spawn(c.kind))
+                        return -1;
+                    continue;
+                }
+                if (spawn(c.kind))
+                    return -1;
+                kill(c.pid, SIGTERM);
+            }
+        }
+        else if (sig == SIGTERM || sig == SIGINT)
+        {
+            stopping = true;
+            for (const Child &c : children)
+                kill(c.pid, SIGTERM);
+            if (children.empty())
+                return 0;
+        }
+    }
 }
 
 int main()
 {
+    ProcessRole role;
+    if (long workers = env_long("MINIBANK_WORKERS", 0); workers > 0)
+    {
+        int rc = run_supervisor((int)workers, role);
+        if (rc >= 0)
+            return rc;
+    }
+    // SIGTERM/SIGINT stop the server gracefully; block them before any
+    // thread starts so only the waiter thread below receives them
+    sigset_t stop_sigs;
+    sigemptyset(&stop_sigs);
+    sigaddset(&stop_sigs, SIGTERM);
+    sigaddset(&stop_sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop_sigs, nullptr);
+
     sqlite3 *db;
     if (sqlite3_open("bank.db", &db) != SQLITE_OK)
     {
@@ -150,16 +4414,404 @@ int main()
         return 1;
     }
 
-    httplib::Server server;
+    // WAL lets the slow-query explainer read on its own connection without
+    // blocking (or being blocked by) ledger writes
+    exec_sql(db, "PRAGMA journal_mode=WAL;");
+    sqlite3_busy_timeout(db, 5000);
+    if (role.kind != ProcessRole::Worker)
+        upgrade_schema(db);
+
+    // one read snapshot for everything loaded below, so a worker's follower
+    // starts exactly after the last row they saw
+    exec_sql(db, "BEGIN;");
+    // money-moving handlers share one connection; serialize them so the
+    // balance checks, ledger rows and index appends happen in commit order
+    std::mutex ledger_mu;
+    LedgerIndex ledger_index;
+    std::cout << "Indexed " << ledger_index.load(db) << " ledger rows\n";
+    AccountCache account_cache((size_t)env_long("MINIBANK_ACCOUNT_CACHE_MB", 64) << 20);
+    VersionTable versions;
+    versions.load(db);
+    ChangeBus change_bus;
+    size_t stream_queue = (size_t)env_long("MINIBANK_STREAM_QUEUE", 256);
+    ChangeLog change_log((size_t)env_long("MINIBANK_CHANGELOG_SIZE", 65536));
+    long long seen_tx = 0, seen_acc = 0;
+    {
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT COALESCE((SELECT MAX(id) FROM transactions), 0), COALESCE((SELECT MAX(id) FROM accounts), 0)", -1, &stmt, nullptr);
+        if (sqlite3_step(stmt) == SQLITE_ROW) { seen_tx = sqlite3_column_int64(stmt, 0); seen_acc = sqlite3_column_int64(stmt, 1); }
+        sqlite3_finalize(stmt);
+        change_log.prime(seen_tx);
+    }
+    exec_sql(db, "COMMIT;");
+
+    // everything that observes a committed ledger row; callers hold ledger_mu
+    // so this runs in commit order
+    auto on_ledger_write = [&](LedgerEvent ev)
+    {
+        if (!ev.from.empty())
+        {
+            ledger_index.append(ev.from, ev.created_at, 0, ev.amount);
+            if (ev.from_balance)
+                account_cache.set_balance(ev.from, *ev.from_balance);
+            versions.bump(ev.from);
+            ev.from_user = versions.owner(ev.from);
+        }
+        if (!ev.to.empty())
+        {
+            ledger_index.append(ev.to, ev.created_at, ev.amount, 0);
+            if (ev.to_balance)
+                account_cache.set_balance(ev.to, *ev.to_balance);
+            versions.bump(ev.to);
+            ev.to_user = versions.owner(ev.to);
+        }
+        auto evp = std::make_shared<const LedgerEvent>(std::move(ev));
+        change_log.append(evp);
+        change_bus.publish(evp);
+    };
+
+    Metrics metrics;
+    SqlStats sql_stats("bank.db", (uint64_t)env_long("MINIBANK_SLOW_SQL_MS", 100) * 1000);
+    SqlProfile sql_profile;
+    sql_profile.metrics = &metrics;
+    sql_profile.stats = &sql_stats;
+    sql_profile.statement_hist = metrics.histogram("minibank_sqlite_statement_duration_seconds", "Wall time of each SQLite statement from first step to reset/finalize.");
+    sql_profile.commit_hist = metrics.histogram("minibank_sqlite_commit_duration_seconds", "Wall time of explicit COMMIT statements.");
+    sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, sql_profile_cb, &sql_profile);
+    metrics.gauge("minibank_account_cache_hits_total", "Account cache lookups served from memory.", [&] { return (double)account_cache.hits(); }, true);
+    metrics.gauge("minibank_account_cache_misses_total", "Account cache lookups that went to SQLite.", [&] { return (double)account_cache.misses(); }, true);
+    metrics.gauge("minibank_account_cache_evictions_total", "Users evicted from the account cache.", [&] { return (double)account_cache.evictions(); }, true);
+    std::string audit_policy = std::getenv("MINIBANK_AUDIT_POLICY") ? std::getenv("MINIBANK_AUDIT_POLICY") : "drop";
+    AuditLog audit(db, ledger_mu, (size_t)env_long("MINIBANK_AUDIT_QUEUE", 65536),
+                   audit_policy == "block" ? AuditLog::Policy::Block : AuditLog::Policy::Drop,
+                   env_long("MINIBANK_AUDIT_DURABLE", 0) != 0);
+    metrics.gauge("minibank_audit_queue_depth", "Audit records not yet committed.", [&] { return (double)audit.depth(); });
+    metrics.gauge("minibank_audit_dropped_total", "Audit records dropped (ring full or write failure).", [&] { return (double)audit.dropped(); }, true);
+    metrics.gauge("minibank_audit_written_total", "Audit records committed to audit_logs.", [&] { return (double)audit.written(); }, true);
+    metrics.gauge("minibank_audit_batches_total", "Audit batch transactions committed.", [&] { return (double)audit.batches(); }, true);
+    metrics.gauge("minibank_stream_subscribers", "Open /stream connections.", [&] { return (double)change_bus.subscribers(); });
+    metrics.gauge("minibank_changelog_events", "Ledger events held in the /changes ring.", [&] { return (double)change_log.size(); });
+
+    Tracer tracer(std::getenv("MINIBANK_TRACE_FILE") ? std::getenv("MINIBANK_TRACE_FILE") : "", env_long("MINIBANK_TRACE_SAMPLE", 100));
+    // each process of a supervised group writes its own capture; the writer's
+    // duplicates the POSTs the workers relay, so replay the workers' files
+    std::string capture_path = std::getenv("MINIBANK_CAPTURE_FILE") ? std::getenv("MINIBANK_CAPTURE_FILE") : "";
+    if (!capture_path.empty() && role.kind != ProcessRole::Single)
+        capture_path += std::string(".") + role_name(role.kind) + "." + std::to_string(getpid());
+    Capture capture(capture_path);
+    if (capture.enabled())
+    {
+        metrics.gauge("minibank_capture_records_total", "Requests written to the capture file.", [&] { return (double)capture.records(); }, true);
+        metrics.gauge("minibank_capture_dropped_total", "Requests not captured because the writer fell behind.", [&] { return (double)capture.dropped(); }, true);
+    }
+    Compression compression(metrics, env_long("MINIBANK_COMPRESS", 1) != 0, (size_t)env_long("MINIBANK_COMPRESS_MIN", 1024),
+                            (int)env_long("MINIBANK_COMPRESS_LEVEL", Compressor::kDefaultLevel), (size_t)env_long("MINIBANK_COMPRESS_CACHE_MB", 8) << 20);
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    size_t pool_min = (size_t)env_long("MINIBANK_POOL_MIN", std::max(2u, hw)), pool_max = (size_t)env_long("MINIBANK_POOL_MAX", std::max(64u, 8 * hw));
+    // as many handlers as the pool keeps warm (at least 8, for small hosts
+    // whose handlers mostly wait on SQLite), never more than it can run
+    size_t admit_slots = (size_t)env_long("MINIBANK_ADMIT_SLOTS", (long)std::min(pool_max, std::max<size_t>(8, pool_min)));
+    Admission admission(metrics, admit_slots, (size_t)env_long("MINIBANK_ADMIT_RESERVE", std::max<long>(1, (long)admit_slots / 4)),
+                        // exports are CPU bound: a quarter of the cores
+                        (size_t)env_long("MINIBANK_ADMIT_EXPORT_SLOTS", std::max<long>(1, (long)hw / 4)),
+                        (size_t)env_long("MINIBANK_ADMIT_QUEUE", 1024), (size_t)env_long("MINIBANK_ADMIT_EXPORT_QUEUE", 16),
+                        env_long("MINIBANK_ADMIT_MAX_WAIT_MS", 5000));
+    QueryBudget query_budget(metrics, env_long("MINIBANK_QUERY_BUDGET_MS", 2000), env_long("MINIBANK_EXPORT_BUDGET_MS", 10000));
+    query_budget.install(db);
+    // per-route request latency; `route` is the label, not the raw path.
+    // Also records a trace whose id is echoed as X-Request-Id
+    auto timed = [&](const std::string &route, httplib::Server::Handler h) -> httplib::Server::Handler
+    {
+        size_t hist = metrics.histogram("minibank_http_request_duration_seconds", "Handler wall time per route.", "route=\"" + route + "\"");
+        return [&metrics, &tracer, &capture, &compression, &admission, &query_budget, hist, route, h](const httplib::Request &req, httplib::Response &res)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            res.set_header("X-Request-Id", std::to_string(tracer.begin(route)));
+            t_wire = accepted_wire(req);
+            t_coding = compression.negotiate(req);
+            // the epoll front end queued the request before it took this
+            // thread; the threads front end queues it here
+            Admission::Class kind = Admission::classify(req.method, req.path);
+            Admission::Class cls = admission.enabled() ? kind : Admission::Exempt;
+            std::string timeout = req.get_header_value("X-Request-Timeout-Ms");
+            auto received = t_admitted ? t_received : t0;
+            Admission::Verdict v = Admission::Verdict::Run;
+            if (cls != Admission::Exempt)
+            {
+                auto deadline = admission.deadline(timeout, received);
+                v = t_admitted ? admission.check(cls, deadline) : admission.admit(cls, deadline);
+            }
+            if (v == Admission::Verdict::Run)
+            {
+                query_budget.begin(kind, received, timeout.empty() ? QueryBudget::Clock::time_point::max() : admission.deadline(timeout, received), t_client_fd);
+                h(req, res);
+                query_budget.end();
+                if (cls != Admission::Exempt && !t_admitted)
+                    admission.finish(cls);
+            }
+            else
+            {
+                const char *reason = Admission::refusal(v, res.status);
+                res.set_content(std::string(R"({"status":"error","reason":")") + reason + "\"}", "application/json");
+                if (res.status == 503)
+                    res.set_header("Retry-After", "1");
+            }
+            // fixed JSON error bodies that did not go through send_json
+            if (t_wire != Wire::Json && res.get_header_value("Content-Type") == "application/json")
+            {
+                json j = json::parse(res.body, nullptr, false);
+                if (!j.is_discarded())
+                    send_json(res, j);
+            }
+            // captures keep the identity body so replay can compare it
+            capture.record(req, res, t0);
+            compression.apply(req, res, t_coding);
+            t_wire = Wire::Json;
+            t_coding = Coding::Identity;
+            tracer.end();
+            metrics.observe_since<std::chrono::steady_clock>(hist, t0);
+        };
+    };
+
+    // money movement shared by the HTTP routes and the binary RPC port. The
+    // caller holds ledger_mu and an open transaction (BEGIN IMMEDIATE, so a
+    // balance read cannot go stale before its update, even against another
+    // process); a non-null return is the error reason, and nothing has been
+    // written then ("busy" if a statement failed). On success `ev` describes
+    // the row for on_ledger_write once it is committed.
+    auto ledger_deposit = [&](const std::string &acc, double amt, LedgerEvent &ev) -> const char *
+    {
+        SqlSavepoint sp(db);
+        if (!sp.began())
+            return "busy";
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance + ? WHERE account_number = ? RETURNING balance", -1, &stmt, nullptr);
+        sqlite3_bind_double(stmt, 1, amt);
+        sqlite3_bind_text(stmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
+        int rc = sqlite3_step(stmt);
+        double bal_after = rc == SQLITE_ROW ? sqlite3_column_double(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_ROW)
+            return rc == SQLITE_DONE ? "invalid_account" : "busy";
+
+        sqlite3_stmt* logstmt = nullptr;
+        sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at, to_balance_after) VALUES (?, NULL, ?, ?, ?, ?) RETURNING id", -1, &logstmt, nullptr);
+        std::string txid = random_hex(16);
+        std::string ts = now_iso();
+        sqlite3_bind_text(logstmt, 1, txid.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(logstmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt, 3, amt);
+        sqlite3_bind_text(logstmt, 4, ts.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt, 5, bal_after);
+        bool logged = sqlite3_step(logstmt) == SQLITE_ROW;
+        ev.seq = logged ? sqlite3_column_int64(logstmt, 0) : 0;
+        sqlite3_finalize(logstmt);
+        if (!logged)
+            return "busy";
+        sp.release();
+        ev.tx_uuid = txid; ev.to = acc; ev.amount = amt; ev.created_at = ts; ev.to_balance = bal_after;
+        return nullptr;
+    };
+
+    auto ledger_withdraw = [&](const std::string &acc, double amt, LedgerEvent &ev) -> const char *
+    {
+        SqlSavepoint sp(db);
+        if (!sp.began())
+            return "busy";
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT balance FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
+        double bal = -1;
+        if (sqlite3_step(stmt) == SQLITE_ROW) bal = sqlite3_column_double(stmt,0);
+        sqlite3_finalize(stmt);
+        if (bal < amt || bal < 0)
+            return "insufficient_funds";
+
+        sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance - ? WHERE account_number = ? RETURNING balance", -1, &stmt, nullptr);
+        sqlite3_bind_double(stmt, 1, amt);
+        sqlite3_bind_text(stmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
+        bool debited = sqlite3_step(stmt) == SQLITE_ROW;
+        double bal_after = debited ? sqlite3_column_double(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+        if (!debited)
+            return "busy";
+
+        sqlite3_stmt* logstmt = nullptr;
+        sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at, from_balance_after) VALUES (?, ?, NULL, ?, ?, ?) RETURNING id", -1, &logstmt, nullptr);
+        std::string txid = random_hex(16);
+        std::string ts = now_iso();
+        sqlite3_bind_text(logstmt, 1, txid.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(logstmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt, 3, amt);
+        sqlite3_bind_text(logstmt, 4, ts.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt, 5, bal_after);
+        bool logged = sqlite3_step(logstmt) == SQLITE_ROW;
+        ev.seq = logged ? sqlite3_column_int64(logstmt, 0) : 0;
+        sqlite3_finalize(logstmt);
+        if (!logged)
+            return "busy";
+        sp.release();
+        ev.tx_uuid = txid; ev.from = acc; ev.amount = amt; ev.created_at = ts; ev.from_balance = bal_after;
+        return nullptr;
+    };
+
+    auto ledger_transfer = [&](const std::string &from, const std::string &to, double amt, LedgerEvent &ev) -> const char *
+    {
+        SqlSavepoint sp(db);
+        if (!sp.began())
+            return "busy";
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db, "SELECT balance FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, from.c_str(), -1, SQLITE_TRANSIENT);
+        double bal = -1;
+        if (sqlite3_step(stmt) == SQLITE_ROW) bal = sqlite3_column_double(stmt,0);
+        sqlite3_finalize(stmt);
+        if (bal < amt || bal < 0)
+            return "insufficient_funds";
+
+        // an unknown payee fails the transfer rather than swallowing the money
+        sqlite3_prepare_v2(db, "SELECT 1 FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, to.c_str(), -1, SQLITE_TRANSIENT);
+        bool to_found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        if (!to_found)
+            return "invalid_account";
+
+        sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance - ? WHERE account_number = ? RETURNING balance", -1, &stmt, nullptr);
+        sqlite3_bind_double(stmt,1,amt); sqlite3_bind_text(stmt,2,from.c_str(),-1,SQLITE_TRANSIENT);
+        bool debited = sqlite3_step(stmt) == SQLITE_ROW;
+        double from_after = debited ? sqlite3_column_double(stmt,0) : 0;
+        sqlite3_finalize(stmt);
+        if (!debited)
+            return "busy";
+
+        sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance + ? WHERE account_number = ? RETURNING balance", -1, &stmt, nullptr);
+        sqlite3_bind_double(stmt,1,amt); sqlite3_bind_text(stmt,2,to.c_str(),-1,SQLITE_TRANSIENT);
+        bool credited = sqlite3_step(stmt) == SQLITE_ROW;
+        double to_after = credited ? sqlite3_column_double(stmt,0) : 0;
+        sqlite3_finalize(stmt);
+        if (!credited)
+            return "busy";
+
+        sqlite3_stmt* logstmt = nullptr;
+        sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after) VALUES (?, ?, ?, ?, ?, ?, ?) RETURNING id", -1, &logstmt, nullptr);
+        std::string txid = random_hex(16);
+        std::string ts = now_iso();
+        sqlite3_bind_text(logstmt,1,txid.c_str(),-1,SQLITE_TRANSIENT);
+        sqlite3_bind_text(logstmt,2,from.c_str(),-1,SQLITE_TRANSIENT);
+        sqlite3_bind_text(logstmt,3,to.c_str(),-1,SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt,4,amt);
+        sqlite3_bind_text(logstmt,5,ts.c_str(),-1,SQLITE_TRANSIENT);
+        sqlite3_bind_double(logstmt,6,from_after);
+        sqlite3_bind_double(logstmt,7,to_after);
+        bool logged = sqlite3_step(logstmt) == SQLITE_ROW;
+        ev.seq = logged ? sqlite3_column_int64(logstmt, 0) : 0;
+        sqlite3_finalize(logstmt);
+        if (!logged)
+            return "busy";
+        sp.release();
+        ev.tx_uuid = txid; ev.from = from; ev.to = to; ev.amount = amt; ev.created_at = ts;
+        ev.from_balance = from_after;
+        ev.to_balance = to_after;
+        return nullptr;
+    };
+
+    // after the row is committed and ledger_mu released; false if the audit
+    // record was lost (in durable mode, after its batch failed to write)
+    auto audit_ledger = [&](const LedgerEvent &ev) -> bool
+    {
+        if (!ev.from.empty() && !ev.to.empty())
+            return audit.log(versions.owner(ev.from), ev.type(), true, "from=%s to=%s amount=%.2f tx=%s", ev.from.c_str(), ev.to.c_str(), ev.amount, ev.tx_uuid.c_str());
+        const std::string &acc = ev.from.empty() ? ev.to : ev.from;
+        return audit.log(versions.owner(acc), ev.type(), true, "acc=%s amount=%.2f tx=%s", acc.c_str(), ev.amount, ev.tx_uuid.c_str());
+    };
+
+    // balance as of a timestamp from the ledger index; "" = now, which is
+    // accounts.balance itself, the figure deposit and withdraw report (the
+    // index's running totals round differently)
+    auto ledger_balance = [&](const std::string &acc, const std::string &as_of, double &balance) -> const char *
+    {
+        if (as_of.empty()) {
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db, "SELECT balance FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
+            sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
+            bool found = sqlite3_step(stmt) == SQLITE_ROW;
+            if (found) balance = sqlite3_column_double(stmt, 0);
+            sqlite3_finalize(stmt);
+            return found ? nullptr : "invalid_account";
+        }
+        if (!ledger_index.contains(acc)) {
+            // accounts with no history are not in the index; confirm they exist
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db, "SELECT 1 FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
+            sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
+            bool found = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_finalize(stmt);
+            if (!found)
+                return "invalid_account";
+        }
+        LedgerIndex::Flow f = ledger_index.as_of(acc, as_of);
+        balance = f.in - f.out;
+        return nullptr;
+    };
+
+    WorkerPool::Group pools(metrics, pool_min, pool_max,
+                            env_long("MINIBANK_POOL_IDLE_MS", 10000), WorkerPool::Group::placement(std::getenv("MINIBANK_POOL_AFFINITY") ? std::getenv("MINIBANK_POOL_AFFINITY") : ""));
+    std::cerr << "[POOL] " << pools.describe() << "\n";
+    EpollServer server;
+    server.new_task_queue = [&pools]
+    { return pools.make(); };
+    if (admission.enabled())
+        server.set_admission(&admission);
+    // responses go out as separate header and body writes; without this,
+    // Nagle plus the client's delayed ACK adds ~40 ms to every keep-alive reply
+    server.set_tcp_nodelay(true);
+    // httplib's default is SO_REUSEPORT alone, which cannot bind while the
+    // last run's closed connections sit in TIME_WAIT
+    server.set_socket_options([](socket_t sock)
+                              {
+        int one = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)); });
+
+    // worker: every POST goes to the writer. Registered ahead of the routes
+    // below so it matches first; the pre-routing hook would see no body yet
+    if (role.kind == ProcessRole::Worker)
+        server.Post(".*", timed("/relay", [&](const httplib::Request &req, httplib::Response &res)
+                                {
+            // one short-lived connection per request: the writer runs
+            // httplib's thread per connection, so idle keep-alives from every
+            // worker thread would pin its whole pool
+            httplib::Client cli(role.writer_socket);
+            cli.set_address_family(AF_UNIX);
+            cli.set_read_timeout(30, 0);
+            httplib::Headers fwd;
+            if (req.has_header("Accept"))
+                fwd.emplace("Accept", req.get_header_value("Accept"));
+            // a refused connection never reached a writer, so it is safe to
+            // retry while a SIGHUP restart brings the next one up
+            auto retry_until = std::chrono::steady_clock::now() + kWriterDrain;
+            auto r = cli.Post(req.target, fwd, req.body, req.get_header_value("Content-Type"));
+            while (!r && r.error() == httplib::Error::Connection && std::chrono::steady_clock::now() < retry_until)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                r = cli.Post(req.target, fwd, req.body, req.get_header_value("Content-Type"));
+            }
+            if (!r) { res.status = 503; res.set_content(R"({"status":"error","reason":"writer_unavailable"})", "application/json"); return; }
+            res.status = r->status;
+            for (const auto &h : r->headers)
+                if (h.first != "Content-Length" && h.first != "Content-Type" && h.first != "Connection" && h.first != "Keep-Alive" && h.first != "X-Request-Id")
+                    res.set_header(h.first, h.second);
+            res.set_content(r->body, r->get_header_value("Content-Type")); }));
 
-    server.Get("/", [&](const httplib::Request &, httplib::Response &res)
-               { res.set_content("MiniBank API Running!", "text/plain"); });
+    server.Get("/", timed("/", [&](const httplib::Request &, httplib::Response &res)
+               { res.set_content("MiniBank API Running!", "text/plain"); }));
 
     // Signup
-    server.Post("/signup", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/signup", timed("/signup", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             std::string email = j.value("email", "");
             std::string password = j.value("password", "");
             if (email.empty() || password.empty()) { res.set_content(R"({"status":"error","reason":"missing"})", "application/json"); return; }
@@ -167,25 +4819,33 @@ int main()
             std::string salt = random_hex(24);
             std::string hash = sha256(salt + password);
 
+            // under ledger_mu like every write on the shared connection: the
+            // audit flusher's batch transaction would otherwise take this
+            // INSERT with it if it rolls back
+            auto lk = lock_traced(ledger_mu);
             sqlite3_stmt* stmt = nullptr;
-            sqlite3_prepare_v2(db, "INSERT INTO users (email, password_hash, salt, created_at) VALUES (?, ?, ?, ?)", -1, &stmt, nullptr);
+            sqlite3_prepare_v2(db, "INSERT INTO users (email, password_hash, salt, created_at) VALUES (?, ?, ?, ?) RETURNING id", -1, &stmt, nullptr);
             sqlite3_bind_text(stmt, 1, email.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt, 2, hash.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt, 3, salt.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt, 4, now_iso().c_str(), -1, SQLITE_TRANSIENT);
+            bool ok = sqlite3_step(stmt) == SQLITE_ROW;
+            long long uid = ok ? sqlite3_column_int64(stmt, 0) : 0;
+            ok = sqlite3_step(stmt) == SQLITE_DONE && ok;
+            sqlite3_finalize(stmt);
+            lk.unlock();
 
             json out;
-            if (sqlite3_step(stmt) == SQLITE_DONE) { out["status"] = "ok"; }
-            else { out["status"] = "error"; out["reason"] = "db_insert_failed"; }
-            sqlite3_finalize(stmt);
-            res.set_content(out.dump(), "application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } });
+            if (ok) { out["status"] = "ok"; if (!audit.log(uid, "signup", true, "ok")) out["audit"] = "not_recorded"; }
+            else { out["status"] = "error"; out["reason"] = "db_insert_failed"; audit.log(0, "signup", false, "db_insert_failed"); }
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } }));
 
     // Login
-    server.Post("/login", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/login", timed("/login", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             std::string email = j.value("email",""); std::string password = j.value("password","");
             if (email.empty() || password.empty()) { res.set_content(R"({"status":"error","reason":"missing"})", "application/json"); return; }
 
@@ -207,29 +4867,33 @@ int main()
                     out["status"] = "ok";
                     out["user_id"] = uid;
                     out["email"] = email;
+                    audit.log(uid, "login", false, "ok");
                 } else {
                     // wrong password
                     out["status"] = "invalid";
                     out["reason"] = "wrong_password";
+                    audit.log(uid, "login", false, "wrong_password");
                 }
             } else {
                 sqlite3_finalize(stmt);
                 out["status"] = "invalid";
                 out["reason"] = "not_found";
+                audit.log(0, "login", false, "not_found");
             }
-            res.set_content(out.dump(), "application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } });
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } }));
 
     // create_account
-    server.Post("/create_account", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/create_account", timed("/create_account", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             int user_id = j.value("user_id", 0);
             std::string type = j.value("type","Savings");
             if (user_id == 0) { res.set_content(R"({"status":"error","reason":"missing_user"})", "application/json"); return; }
             std::string accnum = "ACC" + std::to_string((long long)(std::chrono::high_resolution_clock::now().time_since_epoch().count() % 9000000LL) + 100000LL);
 
+            auto lk = lock_traced(ledger_mu);
             sqlite3_stmt* stmt = nullptr;
             sqlite3_prepare_v2(db, "INSERT INTO accounts (user_id, account_number, account_type, balance, created_at) VALUES (?, ?, ?, 0, ?)", -1, &stmt, nullptr);
             sqlite3_bind_int(stmt, 1, user_id);
@@ -238,148 +4902,124 @@ int main()
             sqlite3_bind_text(stmt, 4, now_iso().c_str(), -1, SQLITE_TRANSIENT);
 
             json out;
-            if (sqlite3_step(stmt) == SQLITE_DONE) { out["status"]="ok"; out["account_number"] = accnum; }
+            if (sqlite3_step(stmt) == SQLITE_DONE) { out["status"]="ok"; out["account_number"] = accnum; account_cache.invalidate(user_id); versions.add_account(accnum, user_id); }
             else { out["status"]="error"; }
             sqlite3_finalize(stmt);
-            res.set_content(out.dump(), "application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } });
+            lk.unlock();
+            if (out["status"] == "ok") audit.log(user_id, "create_account", false, "acc=%s type=%.32s", accnum.c_str(), type.c_str());
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } }));
 
     // accounts/{user_id}
-    server.Get(R"(/accounts/(\d+))", [&](const httplib::Request &req, httplib::Response &res)
+    server.Get(R"(/accounts/(\d+))", timed("/accounts/{user_id}", [&](const httplib::Request &req, httplib::Response &res)
                {
         int user_id = std::stoi(req.matches[1]);
-        sqlite3_stmt* stmt = nullptr;
-        sqlite3_prepare_v2(db, "SELECT account_number, account_type, balance FROM accounts WHERE user_id = ?", -1, &stmt, nullptr);
-        sqlite3_bind_int(stmt, 1, user_id);
+        // taken before reading so a concurrent write can only make it stale
+        std::string etag = versions.user_etag(user_id);
+        if (etag_matches(req, etag)) { res.status = 304; res.set_header("ETag", wire_etag(etag)); return; }
+        std::vector<AccountCache::Row> rows;
+        if (!account_cache.get(user_id, rows)) {
+            // fill under the ledger lock so no write-through can slip in
+            // between the read and the insert into the cache
+            auto lk = lock_traced(ledger_mu);
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db, "SELECT account_number, account_type, balance FROM accounts WHERE user_id = ?", -1, &stmt, nullptr);
+            sqlite3_bind_int(stmt, 1, user_id);
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+                rows.push_back({to_str(sqlite3_column_text(stmt,0)), to_str(sqlite3_column_text(stmt,1)), sqlite3_column_double(stmt,2)});
+            sqlite3_finalize(stmt);
+            account_cache.put(user_id, rows);
+        }
         json arr = json::array();
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            json a; a["account_number"] = to_str(sqlite3_column_text(stmt,0));
-            a["account_type"] = to_str(sqlite3_column_text(stmt,1));
-            a["balance"] = sqlite3_column_double(stmt,2);
+        for (const auto &r : rows) {
+            json a; a["account_number"] = r.account_number;
+            a["account_type"] = r.account_type;
+            a["balance"] = r.balance;
             arr.push_back(a);
         }
-        sqlite3_finalize(stmt);
-        res.set_content(arr.dump(), "application/json"); });
+        res.set_header("ETag", wire_etag(etag));
+        send_json(res, arr); }));
 
     // deposit
-    server.Post("/deposit", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/deposit", timed("/deposit", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             std::string acc = j.value("account_number","");
             double amt = j.value("amount", 0.0);
             if (acc.empty() || amt <= 0.0) { res.set_content(R"({"status":"error","reason":"bad_request"})", "application/json"); return; }
 
-            sqlite3_stmt* stmt = nullptr;
-            sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance + ? WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_double(stmt, 1, amt);
-            sqlite3_bind_text(stmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_step(stmt);
-            int changed = sqlite3_changes(db);
-            sqlite3_finalize(stmt);
-
+            auto lk = lock_traced(ledger_mu);
+            SqlTxn txn(db);
+            LedgerEvent ev;
             json out;
-            if (changed == 0) { out["status"]="error"; out["reason"]="invalid_account"; res.set_content(out.dump(),"application/json"); return; }
-
-            sqlite3_stmt* logstmt = nullptr;
-            sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at) VALUES (?, NULL, ?, ?, ?)", -1, &logstmt, nullptr);
-            std::string txid = random_hex(16);
-            sqlite3_bind_text(logstmt, 1, txid.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_text(logstmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_double(logstmt, 3, amt);
-            sqlite3_bind_text(logstmt, 4, now_iso().c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_step(logstmt);
-            sqlite3_finalize(logstmt);
-
-            out["status"]="ok"; out["txid"]=txid;
-            res.set_content(out.dump(),"application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } });
+            const char *reason = !txn.began() ? "busy" : ledger_deposit(acc, amt, ev);
+            if (!reason && !txn.commit()) reason = "busy";
+            if (reason) { out["status"]="error"; out["reason"]=reason; send_json(res, out); return; }
+            on_ledger_write(ev);
+            lk.unlock();
+
+            out["status"]="ok"; out["txid"]=ev.tx_uuid;
+            if (!audit_ledger(ev)) out["audit"]="not_recorded";
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } }));
 
     // withdraw
-    server.Post("/withdraw", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/withdraw", timed("/withdraw", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             std::string acc = j.value("account_number","");
             double amt = j.value("amount", 0.0);
             if (acc.empty() || amt <= 0.0) { res.set_content(R"({"status":"error","reason":"bad_request"})", "application/json"); return; }
 
-            sqlite3_stmt* stmt = nullptr;
-            sqlite3_prepare_v2(db, "SELECT balance FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
-            double bal = -1;
-            if (sqlite3_step(stmt) == SQLITE_ROW) bal = sqlite3_column_double(stmt,0);
-            sqlite3_finalize(stmt);
-
+            auto lk = lock_traced(ledger_mu);
+            SqlTxn txn(db);
+            LedgerEvent ev;
             json out;
-            if (bal < amt || bal < 0) { out["status"]="error"; out["reason"]="insufficient_funds"; res.set_content(out.dump(),"application/json"); return; }
-
-            sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance - ? WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_double(stmt, 1, amt);
-            sqlite3_bind_text(stmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
-
-            sqlite3_stmt* logstmt = nullptr;
-            sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at) VALUES (?, ?, NULL, ?, ?)", -1, &logstmt, nullptr);
-            std::string txid = random_hex(16);
-            sqlite3_bind_text(logstmt, 1, txid.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_text(logstmt, 2, acc.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_double(logstmt, 3, amt);
-            sqlite3_bind_text(logstmt, 4, now_iso().c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_step(logstmt);
-            sqlite3_finalize(logstmt);
+            const char *reason = !txn.began() ? "busy" : ledger_withdraw(acc, amt, ev);
+            if (!reason && !txn.commit()) reason = "busy";
+            if (reason) { out["status"]="error"; out["reason"]=reason; send_json(res, out); return; }
+            on_ledger_write(ev);
+            lk.unlock();
 
-            out["status"]="ok"; res.set_content(out.dump(),"application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } });
+            out["status"]="ok";
+            if (!audit_ledger(ev)) out["audit"]="not_recorded";
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})", "application/json"); } }));
 
     // transfer
-    server.Post("/transfer", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/transfer", timed("/transfer", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             std::string from = j.value("from","");
             std::string to = j.value("to","");
             double amt = j.value("amount",0.0);
             if (from.empty() || to.empty() || amt <= 0.0) { res.set_content(R"({"status":"error","reason":"bad_request"})","application/json"); return; }
 
-            exec_sql(db, "BEGIN IMMEDIATE;");
-
-            sqlite3_stmt* stmt = nullptr;
-            sqlite3_prepare_v2(db, "SELECT balance FROM accounts WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_text(stmt, 1, from.c_str(), -1, SQLITE_TRANSIENT);
-            double bal = -1;
-            if (sqlite3_step(stmt) == SQLITE_ROW) bal = sqlite3_column_double(stmt,0);
-            sqlite3_finalize(stmt);
-
-            if (bal < amt || bal < 0) { exec_sql(db,"ROLLBACK;"); json out; out["status"]="error"; out["reason"]="insufficient_funds"; res.set_content(out.dump(),"application/json"); return; }
-
-            sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance - ? WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_double(stmt,1,amt); sqlite3_bind_text(stmt,2,from.c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_step(stmt); sqlite3_finalize(stmt);
-
-            sqlite3_prepare_v2(db, "UPDATE accounts SET balance = balance + ? WHERE account_number = ?", -1, &stmt, nullptr);
-            sqlite3_bind_double(stmt,1,amt); sqlite3_bind_text(stmt,2,to.c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_step(stmt); sqlite3_finalize(stmt);
-
-            sqlite3_stmt* logstmt = nullptr;
-            sqlite3_prepare_v2(db, "INSERT INTO transactions (tx_uuid, from_account, to_account, amount, created_at) VALUES (?, ?, ?, ?, ?)", -1, &logstmt, nullptr);
-            std::string txid = random_hex(16);
-            sqlite3_bind_text(logstmt,1,txid.c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_bind_text(logstmt,2,from.c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_bind_text(logstmt,3,to.c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_bind_double(logstmt,4,amt);
-            sqlite3_bind_text(logstmt,5,now_iso().c_str(),-1,SQLITE_TRANSIENT);
-            sqlite3_step(logstmt); sqlite3_finalize(logstmt);
+            auto lk = lock_traced(ledger_mu);
+            SqlTxn txn(db);
+            if (!txn.began()) { json out; out["status"]="error"; out["reason"]="busy"; send_json(res, out); return; }
 
-            exec_sql(db, "COMMIT;");
-            json out; out["status"]="ok"; out["tx_uuid"]=txid; res.set_content(out.dump(),"application/json");
-        } catch(...) { exec_sql(db,"ROLLBACK;"); res.set_content(R"({"status":"error","reason":"json_parse_failed"})","application/json"); } });
+            LedgerEvent ev;
+            if (const char *reason = ledger_transfer(from, to, amt, ev)) { txn.rollback(); json out; out["status"]="error"; out["reason"]=reason; send_json(res, out); return; }
+            // publish only what is durable, as the RPC executor does
+            if (!txn.commit()) { json out; out["status"]="error"; out["reason"]="busy"; send_json(res, out); return; }
+            on_ledger_write(ev);
+            lk.unlock();
+            json out; out["status"]="ok"; out["tx_uuid"]=ev.tx_uuid;
+            if (!audit_ledger(ev)) out["audit"]="not_recorded";
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})","application/json"); } }));
 
     // transactions/{acc}
-    server.Get(R"(/transactions/(.*))", [&](const httplib::Request &req, httplib::Response &res)
+    server.Get(R"(/transactions/(.*))", timed("/transactions/{acc}", [&](const httplib::Request &req, httplib::Response &res)
                {
         std::string acc = req.matches[1];
+        std::string etag = versions.account_etag(acc);
+        if (etag_matches(req, etag)) { res.status = 304; res.set_header("ETag", wire_etag(etag)); return; }
+        QueryBudget::Scope budget;
         sqlite3_stmt* stmt = nullptr;
         sqlite3_prepare_v2(db, "SELECT from_account, to_account, amount, created_at FROM transactions WHERE from_account = ? OR to_account = ? ORDER BY id DESC", -1, &stmt, nullptr);
         sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
@@ -396,12 +5036,70 @@ int main()
             arr.push_back(t);
         }
         sqlite3_finalize(stmt);
-        res.set_content(arr.dump(), "application/json"); });
+        // out of budget: the newest rows so far, flagged and never cached
+        if (QueryBudget::Reason r = budget.stopped()) {
+            if (r != QueryBudget::Timeout || arr.empty()) { QueryBudget::refuse(r, res); return; }
+            res.set_header("X-Partial-Result", "true");
+        } else {
+            res.set_header("ETag", wire_etag(etag));
+        }
+        send_json(res, arr); }));
+
+    // GET /statement/{acc}?before_id=&limit=  newest first, with the account's
+    // balance after each row; pass the returned next_before_id to page back
+    server.Get(R"(/statement/([^/]+))", timed("/statement/{acc}", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        std::string acc = req.matches[1];
+        long long before = req.has_param("before_id") ? std::atoll(req.get_param_value("before_id").c_str()) : LLONG_MAX;
+        int limit = req.has_param("limit") ? std::atoi(req.get_param_value("limit").c_str()) : 50;
+        if (limit <= 0 || limit > 500) limit = 50;
+
+        // two index range reads (one per leg) merged, instead of an OR scan
+        QueryBudget::Scope budget;
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(db,
+            "SELECT * FROM (SELECT id, tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after FROM transactions WHERE from_account = ?1 AND id < ?2 ORDER BY id DESC LIMIT ?3) "
+            "UNION "
+            "SELECT * FROM (SELECT id, tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after FROM transactions WHERE to_account = ?1 AND id < ?2 ORDER BY id DESC LIMIT ?3) "
+            "ORDER BY id DESC LIMIT ?3", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, before);
+        sqlite3_bind_int(stmt, 3, limit);
+        json arr = json::array();
+        long long last_id = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            json t;
+            last_id = sqlite3_column_int64(stmt,0);
+            std::string from = to_str(sqlite3_column_text(stmt,2));
+            t["id"] = last_id;
+            t["tx_uuid"] = to_str(sqlite3_column_text(stmt,1));
+            t["from"] = from;
+            t["to"] = to_str(sqlite3_column_text(stmt,3));
+            t["amount"] = sqlite3_column_double(stmt,4);
+            t["time"] = to_str(sqlite3_column_text(stmt,5));
+            int col = from == acc ? 6 : 7;
+            if (sqlite3_column_type(stmt,col) == SQLITE_NULL) t["balance"] = nullptr;
+            else t["balance"] = sqlite3_column_double(stmt,col);
+            arr.push_back(t);
+        }
+        sqlite3_finalize(stmt);
+        // out of budget: a short page marked partial; next_before_id
+        // continues from its last row
+        QueryBudget::Reason stopped = budget.stopped();
+        if (stopped && (stopped != QueryBudget::Timeout || arr.empty())) { QueryBudget::refuse(stopped, res); return; }
+        json out;
+        out["status"] = "ok";
+        out["account_number"] = acc;
+        out["transactions"] = arr;
+        if (stopped) out["partial"] = true;
+        if (stopped || (int)arr.size() == limit) out["next_before_id"] = last_id;
+        send_json(res, out); }));
 
     // export csv
-    server.Get(R"(/export_transactions/(.*))", [&](const httplib::Request &req, httplib::Response &res)
+    server.Get(R"(/export_transactions/(.*))", timed("/export_transactions/{acc}", [&](const httplib::Request &req, httplib::Response &res)
                {
         std::string acc = req.matches[1];
+        QueryBudget::Scope budget;
         sqlite3_stmt* stmt = nullptr;
         sqlite3_prepare_v2(db, "SELECT id, tx_uuid, from_account, to_account, amount, created_at FROM transactions WHERE from_account = ? OR to_account = ? ORDER BY id DESC", -1, &stmt, nullptr);
         sqlite3_bind_text(stmt, 1, acc.c_str(), -1, SQLITE_TRANSIENT);
@@ -417,11 +5115,127 @@ int main()
             csv << "\"" << to_str(sqlite3_column_text(stmt,5)) << "\"\n";
         }
         sqlite3_finalize(stmt);
-        res.set_content(csv.str(), "text/csv"); });
+        // a truncated file would look complete; fail the whole export
+        if (QueryBudget::Reason r = budget.stopped()) { QueryBudget::refuse(r, res); return; }
+        res.set_content(csv.str(), "text/csv"); }));
+
+    // GET /stream/accounts/{user_id}  Server-Sent Events for every ledger row
+    // touching the user's accounts. "resync" means events were dropped
+    // because the client fell behind; re-read /accounts to catch up.
+    server.Get(R"(/stream/accounts/(\d+))", timed("/stream/accounts/{user_id}", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        int user_id = std::stoi(req.matches[1]);
+        auto sub = change_bus.subscribe(user_id, stream_queue);
+        res.set_header("Cache-Control", "no-cache");
+        // binary clients get a MessagePack stream / CBOR sequence of
+        // {"event", "id", "data"} maps in place of SSE frames
+        Wire wire = t_wire;
+        res.set_chunked_content_provider(wire == Wire::Json ? "text/event-stream" : wire == Wire::MsgPack ? "application/msgpack" : "application/cbor-seq",
+            [sub, wire](size_t offset, httplib::DataSink &sink) {
+                std::string out;
+                if (offset == 0 && wire == Wire::Json) out = "retry: 3000\n\n";
+                {
+                    std::unique_lock<std::mutex> lk(sub->mu);
+                    sub->cv.wait_for(lk, std::chrono::seconds(15), [&] { return !sub->q.empty() || sub->overflowed; });
+                    if (sub->overflowed) {
+                        out += wire == Wire::Json ? "event: resync\ndata: {}\n\n" : encode({{"event", "resync"}}, wire);
+                        sub->overflowed = false;
+                    }
+                    for (const auto &ev : sub->q)
+                        out += wire == Wire::Json ? "id: " + std::to_string(ev->seq) + "\nevent: ledger\ndata: " + ev->to_json(sub->user_id).dump() + "\n\n"
+                                                  : encode({{"event", "ledger"}, {"id", ev->seq}, {"data", ev->to_json(sub->user_id)}}, wire);
+                    sub->q.clear();
+                }
+                if (out.empty()) out = wire == Wire::Json ? ": keepalive\n\n" : encode({{"event", "keepalive"}}, wire);
+                return sink.write(out.data(), out.size());
+            },
+            [sub, &change_bus](bool) { change_bus.unsubscribe(sub); }); }));
+
+    // GET /changes?after=<seq>&limit=&wait=<seconds>  ordered ledger feed.
+    // Returns events with seq > after in commit order; if there are none yet
+    // it long-polls up to `wait` seconds. Consumers resume from "next", so a
+    // crash between processing and saving the cursor replays (at least once).
+    server.Get("/changes", timed("/changes", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        long long after = std::atoll(req.get_param_value("after").c_str());
+        int limit = req.has_param("limit") ? std::atoi(req.get_param_value("limit").c_str()) : 500;
+        if (limit <= 0 || limit > 5000) limit = 500;
+        long wait_s = req.has_param("wait") ? std::atol(req.get_param_value("wait").c_str()) : 25;
+        if (wait_s < 0 || wait_s > 60) wait_s = 25;
+
+        std::vector<std::shared_ptr<const LedgerEvent>> evs;
+        bool from_memory = change_log.read_after(after, limit, evs);
+        if (from_memory && evs.empty() && wait_s > 0 && change_log.wait_after(after, std::chrono::seconds(wait_s)))
+            from_memory = change_log.read_after(after, limit, evs);
+
+        json arr = json::array();
+        long long next = after;
+        if (from_memory) {
+            for (const auto &ev : evs) { arr.push_back(ev->to_json()); next = ev->seq; }
+        } else {
+            // older than the ring: primary-key range read
+            sqlite3_stmt* stmt = nullptr;
+            sqlite3_prepare_v2(db, "SELECT id, tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after FROM transactions WHERE id > ? ORDER BY id LIMIT ?", -1, &stmt, nullptr);
+            sqlite3_bind_int64(stmt, 1, after);
+            sqlite3_bind_int(stmt, 2, limit);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                LedgerEvent ev;
+                ev.seq = sqlite3_column_int64(stmt,0);
+                ev.tx_uuid = to_str(sqlite3_column_text(stmt,1));
+                ev.from = to_str(sqlite3_column_text(stmt,2));
+                ev.to = to_str(sqlite3_column_text(stmt,3));
+                ev.amount = sqlite3_column_double(stmt,4);
+                ev.created_at = to_str(sqlite3_column_text(stmt,5));
+                if (sqlite3_column_type(stmt,6) != SQLITE_NULL) ev.from_balance = sqlite3_column_double(stmt,6);
+                if (sqlite3_column_type(stmt,7) != SQLITE_NULL) ev.to_balance = sqlite3_column_double(stmt,7);
+                arr.push_back(ev.to_json());
+                next = ev.seq;
+            }
+            sqlite3_finalize(stmt);
+        }
+        json out;
+        out["status"] = "ok";
+        out["source"] = from_memory ? "memory" : "db";
+        out["events"] = arr;
+        out["next"] = next;
+        send_json(res, out); }));
+
+    // GET /balance/{acc}?as_of=YYYY-MM-DD[ HH:MM:SS]
+    server.Get(R"(/balance/([^/]+))", timed("/balance/{acc}", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        std::string acc = req.matches[1];
+        std::string as_of = day_bound(req.get_param_value("as_of"), true);
+        json out;
+        if (!as_of.empty() && !LedgerIndex::valid_time(as_of)) { out["status"]="error"; out["reason"]="bad_request"; send_json(res, out); return; }
+        double balance = 0;
+        if (const char *reason = ledger_balance(acc, as_of, balance)) { out["status"]="error"; out["reason"]=reason; send_json(res, out); return; }
+        out["status"] = "ok";
+        out["account_number"] = acc;
+        if (!as_of.empty()) out["as_of"] = as_of;
+        out["balance"] = balance;
+        send_json(res, out); }));
+
+    // GET /flow/{acc}?from=...&to=...  (inclusive, either bound optional)
+    server.Get(R"(/flow/([^/]+))", timed("/flow/{acc}", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        std::string acc = req.matches[1];
+        std::string from = day_bound(req.get_param_value("from"), false);
+        std::string to = day_bound(req.get_param_value("to"), true);
+        json out;
+        if ((!from.empty() && !LedgerIndex::valid_time(from)) || (!to.empty() && !LedgerIndex::valid_time(to))) { out["status"]="error"; out["reason"]="bad_request"; send_json(res, out); return; }
+        LedgerIndex::Flow f = ledger_index.between(acc, from, to);
+        out["status"] = "ok";
+        out["account_number"] = acc;
+        if (!from.empty()) out["from"] = from;
+        if (!to.empty()) out["to"] = to;
+        out["inflow"] = f.in;
+        out["outflow"] = f.out;
+        out["net"] = f.in - f.out;
+        send_json(res, out); }));
 
     // ---- PROFILE ENDPOINTS ----
     // GET /profile/{user_id}
-    server.Get(R"(/profile/(\d+))", [&](const httplib::Request &req, httplib::Response &res)
+    server.Get(R"(/profile/(\d+))", timed("/profile/{user_id}", [&](const httplib::Request &req, httplib::Response &res)
                {
         int uid = std::stoi(req.matches[1]);
         sqlite3_stmt* stmt = nullptr;
@@ -443,36 +5257,294 @@ int main()
             out["reason"] = "not_found";
         }
         sqlite3_finalize(stmt);
-        res.set_content(out.dump(), "application/json"); });
+        send_json(res, out); }));
 
     // POST /profile/update
-    server.Post("/profile/update", [&](const httplib::Request &req, httplib::Response &res)
+    server.Post("/profile/update", timed("/profile/update", [&](const httplib::Request &req, httplib::Response &res)
                 {
         try {
-            auto j = json::parse(req.body);
+            auto j = parse_body(req);
             int uid = j.value("user_id", 0);
             std::string name = j.value("name", "");
             std::string phone = j.value("phone", "");
             std::string address = j.value("address", "");
             if (uid == 0) { res.set_content(R"({"status":"error","reason":"missing_user"})","application/json"); return; }
+            auto lk = lock_traced(ledger_mu);
             sqlite3_stmt* stmt = nullptr;
             sqlite3_prepare_v2(db, "UPDATE users SET name = ?, phone = ?, address = ? WHERE id = ?", -1, &stmt, nullptr);
             sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt, 2, phone.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_text(stmt, 3, address.c_str(), -1, SQLITE_TRANSIENT);
             sqlite3_bind_int(stmt, 4, uid);
+            bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_finalize(stmt);
+            lk.unlock();
             json out;
-            if (sqlite3_step(stmt) == SQLITE_DONE) { out["status"]="ok"; }
+            if (ok) { out["status"]="ok"; audit.log(uid, "profile_update", false, "ok"); }
             else { out["status"]="error"; out["reason"]="db_update_failed"; }
-            sqlite3_finalize(stmt);
-            res.set_content(out.dump(),"application/json");
-        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})","application/json"); } });
+            send_json(res, out);
+        } catch(...) { res.set_content(R"({"status":"error","reason":"json_parse_failed"})","application/json"); } }));
+
+    // GET /debug/traces?limit=20  slowest recent requests by phase
+    server.Get("/debug/traces", [&](const httplib::Request &req, httplib::Response &res)
+               {
+        int limit = req.has_param("limit") ? std::atoi(req.get_param_value("limit").c_str()) : 20;
+        json out;
+        out["status"] = "ok";
+        out["traces"] = tracer.slowest(limit > 0 ? (size_t)limit : 20);
+        send_json(res, out); });
+
+    // GET /debug/sql  per-statement timings, scan counts and recent slow queries
+    server.Get("/debug/sql", [&](const httplib::Request &, httplib::Response &res)
+               {
+        json out = sql_stats.to_json();
+        out["status"] = "ok";
+        send_json(res, out); });
+
+    // Prometheus scrape endpoint
+    server.Get("/metrics", [&](const httplib::Request &, httplib::Response &res)
+               { res.set_content(metrics.render(), "text/plain; version=0.0.4"); });
+
+    // rows another process committed past seen_acc/seen_tx go through
+    // on_ledger_write here too, so caches, ETags, /changes and /stream match;
+    // returns the ledger rows applied (at most 1000 per call)
+    sqlite3_stmt *follow_accs = nullptr, *follow_txs = nullptr;
+    sqlite3_prepare_v2(db, "SELECT id, user_id, account_number FROM accounts WHERE id > ? ORDER BY id", -1, &follow_accs, nullptr);
+    sqlite3_prepare_v2(db, "SELECT id, tx_uuid, from_account, to_account, amount, created_at, from_balance_after, to_balance_after FROM transactions WHERE id > ? ORDER BY id LIMIT 1000", -1, &follow_txs, nullptr);
+    auto follow_once = [&]() -> size_t
+    {
+        // accounts first, so new accounts have owners before their first event
+        sqlite3_bind_int64(follow_accs, 1, seen_acc);
+        while (sqlite3_step(follow_accs) == SQLITE_ROW)
+        {
+            seen_acc = sqlite3_column_int64(follow_accs, 0);
+            int uid = sqlite3_column_int(follow_accs, 1);
+            versions.add_account(to_str(sqlite3_column_text(follow_accs, 2)), uid);
+            account_cache.invalidate(uid);
+        }
+        sqlite3_reset(follow_accs);
+        std::vector<LedgerEvent> batch;
+        sqlite3_bind_int64(follow_txs, 1, seen_tx);
+        while (sqlite3_step(follow_txs) == SQLITE_ROW)
+        {
+            LedgerEvent ev;
+            ev.seq = seen_tx = sqlite3_column_int64(follow_txs, 0);
+            ev.tx_uuid = to_str(sqlite3_column_text(follow_txs, 1));
+            ev.from = to_str(sqlite3_column_text(follow_txs, 2));
+            ev.to = to_str(sqlite3_column_text(follow_txs, 3));
+            ev.amount = sqlite3_column_double(follow_txs, 4);
+            ev.created_at = to_str(sqlite3_column_text(follow_txs, 5));
+            if (sqlite3_column_type(follow_txs, 6) != SQLITE_NULL)
+                ev.from_balance = sqlite3_column_double(follow_txs, 6);
+            if (sqlite3_column_type(follow_txs, 7) != SQLITE_NULL)
+                ev.to_balance = sqlite3_column_double(follow_txs, 7);
+            batch.push_back(std::move(ev));
+        }
+        sqlite3_reset(follow_txs);
+        if (!batch.empty())
+        {
+            std::lock_guard<std::mutex> lk(ledger_mu);
+            for (LedgerEvent &ev : batch)
+                on_ledger_write(std::move(ev));
+        }
+        return batch.size();
+    };
+
+    // worker: apply the writer's commits as they land
+    std::atomic<bool> following{role.kind == ProcessRole::Worker};
+    std::thread follower;
+    if (role.kind == ProcessRole::Worker)
+        follower = std::thread([&]
+                               {
+            long poll_ms = env_long("MINIBANK_FOLLOW_MS", 10);
+            while (following.load())
+                if (follow_once() < 1000) std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms)); });
+
+    // colocated clients can skip TCP loopback; bound ahead of a handoff so the
+    // path leads here before the predecessor lets go
+    const char *unix_path = role.kind == ProcessRole::Single ? std::getenv("MINIBANK_UNIX_SOCKET") : nullptr;
+    bool tcp = !unix_path || env_long("MINIBANK_TCP", 1) != 0;
+    if (unix_path)
+    {
+        const char *mode = std::getenv("MINIBANK_UNIX_SOCKET_MODE"), *group = std::getenv("MINIBANK_UNIX_SOCKET_GROUP");
+        if (!server.bind_unix(unix_path, mode ? (mode_t)std::strtol(mode, nullptr, 8) : 0660, group ? group : ""))
+        {
+            std::cerr << "Failed to bind " << unix_path << "\n";
+            sqlite3_close(db);
+            return 1;
+        }
+    }
+
+    // binary RPC for internal callers; bound now so a bad port fails startup,
+    // serving only once any handoff is complete
+    std::unique_ptr<RpcServer> rpc;
+    if (long rpc_port = role.kind == ProcessRole::Single ? env_long("MINIBANK_RPC_PORT", 0) : 0; rpc_port > 0)
+    {
+        std::string rpc_host = std::getenv("MINIBANK_RPC_HOST") ? std::getenv("MINIBANK_RPC_HOST") : "127.0.0.1";
+        rpc.reset(new RpcServer(metrics));
+        if (!rpc->listen(rpc_host, (int)rpc_port))
+        {
+            std::cerr << "Failed to bind RPC port " << rpc_host << ":" << rpc_port << "\n";
+            sqlite3_close(db);
+            return 1;
+        }
+    }
+
+    std::thread stopper([&]
+                        {
+        int sig = 0;
+        sigwait(&stop_sigs, &sig);
+        server.stop();
+        server.stop_epoll(); });
+
+    // a running server on the handoff socket gives us its listener; we start
+    // accepting only once it has drained and exited
+    Handoff handoff(tcp && role.kind == ProcessRole::Single && std::getenv("MINIBANK_HANDOFF_SOCKET") ? std::getenv("MINIBANK_HANDOFF_SOCKET") : "");
+    int inherited = handoff.take_over();
+    if (inherited >= 0)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        if (!handoff.wait_predecessor((int)env_long("MINIBANK_HANDOFF_TIMEOUT_MS", 30000)))
+            std::cerr << "[HANDOFF] old process still running, serving anyway\n";
+        size_t caught = 0;
+        for (size_t n; (n = follow_once()) > 0;)
+            caught += n;
+        std::cerr << "[HANDOFF] took over the listener; old process drained in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()
+                  << " ms, " << caught << " ledger rows applied since startup\n";
+    }
+    // lets httplib's accept loop notice release_listener()
+    if (handoff.enabled())
+        server.set_idle_interval(0, 100000);
+
+    // consecutive money movements in a batch share one transaction, so a
+    // pipelining caller pays one WAL sync per batch; a balance read commits
+    // what precedes it first, so every reply reflects the requests before it
+    if (rpc)
+        rpc->start([&](const std::vector<RpcCall> &calls, std::vector<RpcReply> &replies)
+                   {
+            for (size_t i = 0; i < calls.size();)
+            {
+                replies[i].id = calls[i].id;
+                if (calls[i].op == 0 || calls[i].op == (uint8_t)RpcOp::Balance)
+                {
+                    const char *reason = calls[i].op == 0 ? "bad_request" : ledger_balance(calls[i].account, "", replies[i].balance);
+                    replies[i].ok = !reason;
+                    if (reason)
+                        replies[i].text = reason;
+                    ++i;
+                    continue;
+                }
+                auto lk = lock_traced(ledger_mu);
+                bool began = exec_sql(db, "BEGIN IMMEDIATE;") == SQLITE_OK;
+                std::vector<std::pair<size_t, LedgerEvent>> done;
+                size_t j = i;
+                for (; j < calls.size() && calls[j].op != 0 && calls[j].op != (uint8_t)RpcOp::Balance; ++j)
+                {
+                    const RpcCall &c = calls[j];
+                    replies[j].id = c.id;
+                    LedgerEvent ev;
+                    const char *reason = !began ? "busy"
+                        : c.account.empty() || !(c.amount > 0.0) || !std::isfinite(c.amount) || (c.op == (uint8_t)RpcOp::Transfer && c.to.empty()) ? "bad_request"
+                        : c.op == (uint8_t)RpcOp::Deposit ? ledger_deposit(c.account, c.amount, ev)
+                        : c.op == (uint8_t)RpcOp::Withdraw ? ledger_withdraw(c.account, c.amount, ev)
+                                                           : ledger_transfer(c.account, c.to, c.amount, ev);
+                    if (reason)
+                        replies[j].text = reason;
+                    else
+                        done.emplace_back(j, std::move(ev));
+                }
+                if (began && exec_sql(db, "COMMIT;") != SQLITE_OK)
+                {
+                    exec_sql(db, "ROLLBACK;");
+                    for (auto &d : done)
+                        replies[d.first].text = "busy";
+                    done.clear();
+                }
+                for (auto &d : done)
+                {
+                    RpcReply &r = replies[d.first];
+                    r.ok = true;
+                    r.text = d.second.tx_uuid;
+                    r.balance = d.second.from.empty() ? d.second.to_balance.value_or(0) : d.second.from_balance.value_or(0);
+                    on_ledger_write(d.second);
+                }
+                lk.unlock();
+                for (auto &d : done)
+                    audit_ledger(d.second);
+                i = j;
+            } });
 
-    std::cout << "MiniBank Server running at http://localhost:8080\n";
-    bool ok = server.listen("0.0.0.0", 8080);
+    std::string frontend = std::getenv("MINIBANK_FRONTEND") ? std::getenv("MINIBANK_FRONTEND") : "threads";
+    std::string where = tcp ? "http://localhost:8080" : "";
+    if (unix_path)
+        where += (tcp ? " and " : "") + std::string(unix_path);
+    if (rpc)
+        where += ", binary RPC on port " + std::to_string(env_long("MINIBANK_RPC_PORT", 0));
+    metrics.gauge("minibank_http_responses_total", "HTTP responses written by the front end.", [&] { return (double)server.responses(); }, true);
+    metrics.gauge("minibank_http_pipelined_requests_total", "Requests already read behind an earlier one on their connection.", [&] { return (double)server.pipelined(); }, true);
+    metrics.gauge("minibank_http_response_writes_total", "Socket writes carrying HTTP responses; pipelined responses share one.", [&] { return (double)server.response_writes(); }, true);
+    bool ok;
+    if (role.kind == ProcessRole::Writer)
+    {
+        ::unlink(role.writer_socket.c_str()); // left behind by a writer that crashed
+        server.set_address_family(AF_UNIX);
+        ok = server.bind_to_port(role.writer_socket, 80);
+        if (ok)
+        {
+            struct stat mine{};
+            chmod(role.writer_socket.c_str(), 0600);
+            stat(role.writer_socket.c_str(), &mine);
+            std::cout << "MiniBank writer " << getpid() << " on " << role.writer_socket << "\n";
+            report_ready(role);
+            ok = server.listen_after_bind();
+            // leave the path alone if a replacement writer has rebound it
+            struct stat now{};
+            if (stat(role.writer_socket.c_str(), &now) == 0 && now.st_ino == mine.st_ino)
+                ::unlink(role.writer_socket.c_str());
+        }
+    }
+    else if (frontend == "epoll")
+    {
+        metrics.gauge("minibank_open_connections", "Client connections held by the epoll front end.", [&] { return (double)server.connections(); });
+        if (inherited >= 0)
+            server.adopt_epoll(inherited);
+        ok = inherited >= 0 || !tcp || server.bind_epoll("0.0.0.0", 8080);
+        if (ok)
+        {
+            std::cout << "MiniBank " << role_name(role.kind) << " " << getpid() << " running at " << where << " (epoll front end)\n";
+            report_ready(role);
+            handoff.start(server);
+            ok = server.serve_epoll((int)env_long("MINIBANK_IO_THREADS", 2));
+        }
+    }
+    else
+    {
+        if (inherited >= 0)
+            server.adopt(inherited);
+        ok = inherited >= 0 || !tcp || server.bind_to_port("0.0.0.0", 8080);
+        if (ok)
+        {
+            std::cout << "MiniBank " << role_name(role.kind) << " " << getpid() << " running at " << where << " (threads front end)\n";
+            report_ready(role);
+            handoff.start(server);
+            ok = server.serve_threads();
+        }
+    }
     if (!ok)
-        std::cerr << "Failed to bind port 8080\n";
+        std::cerr << "Failed to bind " << (role.kind == ProcessRole::Writer ? role.writer_socket : std::string("port 8080")) << "\n";
 
+    handoff.stop();
+    if (rpc)
+        rpc->stop();
+    following = false;
+    if (follower.joinable())
+        follower.join();
+    sqlite3_finalize(follow_accs);
+    sqlite3_finalize(follow_txs);
+    kill(getpid(), SIGTERM); // release the stopper if the server ended on its own
+    stopper.join();
+    audit.close(); // before exit, which is what a successor waits for
     sqlite3_close(db);
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -38,9 +38,15 @@ CREATE TABLE IF NOT EXISTS transactions (
     from_account TEXT,
     to_account TEXT,
     amount REAL NOT NULL,
-    created_at TEXT NOT NULL
+    created_at TEXT NOT NULL,
+    -- balances of each leg right after this row was written
+    from_balance_after REAL,
+    to_balance_after REAL
 );
 
+CREATE INDEX IF NOT EXISTS idx_transactions_from ON transactions(from_account);
+CREATE INDEX IF NOT EXISTS idx_transactions_to ON transactions(to_account);
+
 -- -------------------------
 -- AUDIT LOG TABLE
 -- -------------------------